@@ -0,0 +1,1015 @@
+#include "dagopt.h"
+
+#include <cstdio>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+bool globMatch(std::string_view pattern, std::string_view name) {
+    size_t p = 0, n = 0;
+    size_t starP = std::string_view::npos, starN = 0;
+    
+    while (n < name.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            starP = p++;
+            starN = n;
+            continue;
+        }
+        
+        bool matched = false;
+        size_t nextP = p + 1;
+        if (p < pattern.size() && pattern[p] == '[') {
+            size_t i = p + 1;
+            bool negate = i < pattern.size() && pattern[i] == '!';
+            if (negate) ++i;
+            bool inClass = false;
+            size_t classStart = i;
+            while (i < pattern.size() && (pattern[i] != ']' || i == classStart)) {
+                if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                    inClass = inClass || (pattern[i] <= name[n] && name[n] <= pattern[i + 2]);
+                    i += 3;
+                } else {
+                    inClass = inClass || pattern[i] == name[n];
+                    ++i;
+                }
+            }
+            if (i < pattern.size()) {
+                matched = inClass != negate;
+                nextP = i + 1;
+            } else {
+                matched = name[n] == '[';
+            }
+        } else if (p < pattern.size()) {
+            matched = pattern[p] == '?' || pattern[p] == name[n];
+        }
+        
+        if (matched) {
+            p = nextP;
+            ++n;
+        } else if (starP != std::string_view::npos) {
+            p = starP + 1;
+            n = ++starN;
+        } else {
+            return false;
+        }
+    }
+    
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+int DAGOptimizer::simplify(Opcode op, int left, int right) {
+    if (right == -1) return -1;
+    
+    auto apply = [&](RuleResult rule, int64_t value, int other) {
+        return rule == RuleResult::Other ? other : constantLeaf(value);
+    };
+    
+    if (left == right) {
+        for (const SelfRule& rule : kSelfRules) {
+            if (rule.op == op) return apply(rule.result, rule.value, left);
+        }
+    }
+    
+    int64_t leftValue = 0, rightValue = 0;
+    bool leftConst = immediateOf(left, leftValue);
+    bool rightConst = immediateOf(right, rightValue);
+    for (const IdentityRule& rule : kIdentityRules) {
+        if (rule.op != op) continue;
+        if (rule.side != RuleSide::Left && rightConst && rightValue == rule.operand)
+            return apply(rule.result, rule.value, left);
+        if (rule.side != RuleSide::Right && leftConst && leftValue == rule.operand)
+            return apply(rule.result, rule.value, right);
+    }
+    
+    if (op == Opcode::Mul && leftConst != rightConst) {
+        int64_t factor = leftConst ? leftValue : rightValue;
+        int other = leftConst ? right : left;
+        if (factor == 2) return findOrRegisterExpr(Opcode::Add, other, other);
+        if (factor > 2 && (factor & (factor - 1)) == 0) {
+            int shift = 0;
+            while ((int64_t(1) << shift) != factor) ++shift;
+            return findOrRegisterExpr(Opcode::Shl, other, constantLeaf(shift));
+        }
+    }
+    return -1;
+}
+
+void DAGOptimizer::buildDAG(const Quadruple* first, const Quadruple* last) {
+    for (const Quadruple* it = first; it != last; ++it) {
+        const Quadruple& quad = *it;
+        if (quad.result == kNoSymbol) continue;
+        
+        if (quad.op == Opcode::Assign) {
+            if (quad.arg1 == kNoSymbol) {
+                continue;
+            }
+            
+            bind(quad.result, getNodeForValue(quad.arg1));
+        } else {
+            SymbolId constResult;
+            if (evaluateConstant(quad.op, quad.arg1, quad.arg2, constResult)) {
+                bind(quad.result, getNodeForValue(constResult));
+            } else {
+                int leftId = getNodeForValue(quad.arg1);
+                int rightId = quad.arg2 == kNoSymbol ? -1 : getNodeForValue(quad.arg2);
+                
+                int nodeId = simplify(quad.op, leftId, rightId);
+                if (nodeId != -1) ++totals.simplified;
+                bind(quad.result, nodeId != -1 ? nodeId : findOrRegisterExpr(quad.op, leftId, rightId));
+            }
+        }
+    }
+    
+    if (scope) {
+        for (const Quadruple* it = first; it != last; ++it) scope->kill(it->result);
+    }
+}
+
+std::vector<Quadruple> DAGOptimizer::generateQuadruples(const LiveOutSet* liveOut,
+                                                        const std::vector<SymbolId>& readAfter) {
+    std::vector<Quadruple> result;
+    if (nodes.empty()) return result;
+    
+    if (nodes.compact) nodes.packAliases(varToNode, varToLink);
+    
+    const size_t count = nodes.size();
+    const int* left = nodes.left.data();
+    const int* right = nodes.right.data();
+    
+    // Flags of the variables bound in the block; no other entry of varFlags is read.
+    const uint8_t kLiveVar = 1, kClobbered = 2;
+    for (SymbolId var : mappedVars) {
+        varFlags[var] = 0;
+        busyUntil[var] = -1;
+    }
+    
+    NodeBitset live(count);
+    for (SymbolId var : mappedVars) {
+        if (liveOut && !liveOut->contains(symbols->name(var))) continue;
+        live.set(varToNode[var]);
+        varFlags[var] |= kLiveVar;
+    }
+    for (SymbolId var : readAfter) {
+        if (var == kNoSymbol || var >= static_cast<int>(varToNode.size()) || varToNode[var] == -1) continue;
+        live.set(varToNode[var]);
+        varFlags[var] |= kLiveVar;
+    }
+    
+    for (size_t nodeId = count; nodeId-- > 0;) {
+        if (!live.test(nodeId)) continue;
+        if (left[nodeId] != -1) live.set(left[nodeId]);
+        if (right[nodeId] != -1) live.set(right[nodeId]);
+    }
+    
+    auto keepAlias = [&](SymbolId alias) {
+        return !liveOut || (varFlags[alias] & kLiveVar);
+    };
+    
+    // Every kept alias holds its node's value once the block is done, so expressions over them
+    // are available to the blocks this one dominates. Each node's holder is found once, so an alias
+    // list is walked once however often its node is an operand.
+    if (scope) {
+        std::vector<SymbolId> holders(count, kNoSymbol);
+        for (size_t nodeId = 0; nodeId < count; ++nodeId) {
+            if (!live.test(nodeId)) continue;
+            SymbolId& kept = holders[nodeId];
+            if (symbols->isConstant(nodes.value[nodeId])) {
+                kept = nodes.value[nodeId];
+                continue;
+            }
+            DAGNode(nodes, nodeId).forEachAlias([&](SymbolId alias) {
+                if (kept == kNoSymbol && keepAlias(alias)) kept = alias;
+            });
+        }
+        auto holder = [&](int nodeId) { return nodeId != -1 ? holders[nodeId] : kNoSymbol; };
+        for (size_t nodeId = 0; nodeId < count; ++nodeId) {
+            if (!live.test(nodeId) || DAGNode(nodes, nodeId).isLeaf()) continue;
+            SymbolId result = holder(nodeId);
+            SymbolId arg1 = holder(left[nodeId]);
+            SymbolId arg2 = holder(right[nodeId]);
+            if (result == kNoSymbol || (arg1 == kNoSymbol && left[nodeId] != -1) ||
+                (arg2 == kNoSymbol && right[nodeId] != -1)) {
+                continue;
+            }
+            scope->add(nodes.opcode[nodeId], arg1, arg2, result);
+        }
+    }
+    
+    std::vector<int> lastUse(count, -1);
+    for (size_t nodeId = 0; nodeId < count; ++nodeId) {
+        if (!live.test(nodeId)) continue;
+        if (left[nodeId] != -1) lastUse[left[nodeId]] = nodeId;
+        if (right[nodeId] != -1) lastUse[right[nodeId]] = nodeId;
+    }
+    
+    // A variable read as a leaf (its value on entry) is busy until that leaf's last use. If its
+    // final value is written any earlier it is clobbered: writes to it wait until the end of
+    // the block.
+    auto clobbered = [&](SymbolId var) { return (varFlags[var] & kClobbered) != 0; };
+    for (size_t nodeId = 0; nodeId < count; ++nodeId) {
+        SymbolId value = nodes.value[nodeId];
+        if (!live.test(nodeId) || value == kNoSymbol || symbols->isConstant(value)) continue;
+        busyUntil[value] = std::max<int>(nodeId, lastUse[nodeId]);
+        int finalNode = varToNode[value];
+        if (finalNode != static_cast<int>(nodeId) && finalNode < busyUntil[value]) varFlags[value] |= kClobbered;
+    }
+    
+    // A value without aliases borrows its home name when that name is free from the value's
+    // computation to its last use, and the name's own final value is written no earlier.
+    auto borrowHome = [&](size_t nodeId) {
+        SymbolId home = nodes.home[nodeId];
+        if (home == kNoSymbol || clobbered(home)) return kNoSymbol;
+        if (busyUntil[home] > static_cast<int>(nodeId) || varToNode[home] < lastUse[nodeId]) return kNoSymbol;
+        busyUntil[home] = lastUse[nodeId];
+        return home;
+    };
+    
+    // names[n] is the symbol node n's value is read from; deferred collects the copies into
+    // clobbered variables.
+    std::vector<SymbolId> names(count, kNoSymbol);
+    std::vector<Quadruple> deferred;
+    std::vector<SymbolId> kept;
+    for (size_t nodeId = 0; nodeId < count; ++nodeId) {
+        if (!live.test(nodeId)) continue;
+        DAGNode node(nodes, nodeId);
+        
+        kept.clear();
+        SymbolId scratch = kNoSymbol;
+        node.forEachAlias([&](SymbolId alias) {
+            if (keepAlias(alias)) kept.push_back(alias);
+            if (scratch == kNoSymbol && !clobbered(alias)) scratch = alias;
+        });
+        auto firstWritable = [&]() {
+            for (SymbolId alias : kept) {
+                if (!clobbered(alias)) return alias;
+            }
+            return kNoSymbol;
+        };
+        
+        // Copies made in place read source; deferred ones read holder, which still has the
+        // value at the end of the block.
+        SymbolId source;
+        SymbolId holder;
+        if (!node.isLeaf()) {
+            SymbolId primary = firstWritable();
+            if (primary == kNoSymbol) primary = scratch;
+            if (primary == kNoSymbol && kept.empty()) primary = borrowHome(nodeId);
+            if (primary == kNoSymbol) primary = symbols->internTemporary();
+            SymbolId leftVar = left[nodeId] != -1 ? names[left[nodeId]] : kNoSymbol;
+            SymbolId rightVar = right[nodeId] != -1 ? names[right[nodeId]] : kNoSymbol;
+            
+            result.push_back({node.op(), leftVar, rightVar, primary});
+            names[nodeId] = source = holder = primary;
+        } else if (symbols->isConstant(node.value())) {
+            names[nodeId] = source = holder = node.value();
+        } else {
+            names[nodeId] = source = holder = node.value();
+            bool defers = std::any_of(kept.begin(), kept.end(),
+                                      [&](SymbolId alias) { return clobbered(alias); });
+            if (varToNode[source] != static_cast<int>(nodeId) && defers) {
+                holder = firstWritable();
+                if (holder == kNoSymbol) {
+                    holder = symbols->internTemporary();
+                    result.push_back({Opcode::Assign, source, kNoSymbol, holder});
+                }
+            }
+        }
+        
+        for (SymbolId alias : kept) {
+            if (alias == source) continue;
+            if (clobbered(alias)) deferred.push_back({Opcode::Assign, holder, kNoSymbol, alias});
+            else result.push_back({Opcode::Assign, source, kNoSymbol, alias});
+        }
+    }
+    result.insert(result.end(), deferred.begin(), deferred.end());
+    
+    return result;
+}
+
+void DAGOptimizer::exportDAG(BufferedWriter& out, DagFormat format, const DagFilter& filter) {
+    if (nodes.compact) nodes.packAliases(varToNode, varToLink);
+    
+    size_t count = nodes.size();
+    size_t firstNode = filter.firstNode;
+    size_t lastNode = count ? std::min(filter.lastNode, count - 1) : 0;
+    std::vector<SymbolId> variables(mappedVars);
+    std::sort(variables.begin(), variables.end());
+    NodeBitset reached(count);
+    if (!filter.roots.empty()) {
+        std::vector<int> pending;
+        for (const auto& root : filter.roots) {
+            SymbolId var = symbols->find(root);
+            if (var != kNoSymbol && static_cast<size_t>(var) < varToNode.size() && varToNode[var] != -1) {
+                pending.push_back(varToNode[var]);
+            }
+        }
+        while (!pending.empty()) {
+            int id = pending.back();
+            pending.pop_back();
+            if (reached.test(id)) continue;
+            reached.set(id);
+            DAGNode node(nodes, id);
+            if (node.left() != -1) pending.push_back(node.left());
+            if (node.right() != -1) pending.push_back(node.right());
+        }
+    }
+    auto selected = [&](int id) {
+        return id >= 0 && static_cast<size_t>(id) >= firstNode && static_cast<size_t>(id) <= lastNode
+            && (filter.roots.empty() || reached.test(id));
+    };
+    auto nodeName = [&](const DAGNode& node) -> const std::string& {
+        return node.isLeaf() ? symbols->name(node.value()) : symbols->opcodeName(node.op());
+    };
+    auto appendAliases = [&](const DAGNode& node, bool quoted) {
+        bool first = true;
+        node.forEachAlias([&](SymbolId alias) {
+            if (!first) out.append(", ");
+            if (quoted) {
+                out.append(jsonString(symbols->name(alias)));
+            } else {
+                out.append(symbols->name(alias));
+            }
+            first = false;
+        });
+    };
+    
+    if (format == DagFormat::Dot) {
+        out.append("digraph DAG {\n");
+        for (size_t id = firstNode; id < count && id <= lastNode; ++id) {
+            if (!selected(id)) continue;
+            DAGNode node(nodes, id);
+            out.append("  n");
+            out.append(node.id);
+            out.append(node.isLeaf() ? " [shape=box, label=" : " [label=");
+            out.append(jsonString(nodeName(node)));
+            if (node.hasAliases()) {
+                std::string aliases;
+                node.forEachAlias([&](SymbolId alias) {
+                    if (!aliases.empty()) aliases += ", ";
+                    aliases += symbols->name(alias);
+                });
+                out.append(", xlabel=");
+                out.append(jsonString(aliases));
+            }
+            out.append("];\n");
+            int operands[2] = {node.left(), node.right()};
+            for (int side = 0; side < 2; ++side) {
+                if (!selected(operands[side])) continue;
+                out.append("  n");
+                out.append(node.id);
+                out.append(" -> n");
+                out.append(operands[side]);
+                out.append(side == 0 ? " [label=\"L\"];\n" : " [label=\"R\"];\n");
+            }
+        }
+        out.append("}\n");
+        return;
+    }
+    
+    if (format == DagFormat::Json) {
+        out.append("{\"nodes\": [");
+        bool first = true;
+        for (size_t id = firstNode; id < count && id <= lastNode; ++id) {
+            if (!selected(id)) continue;
+            DAGNode node(nodes, id);
+            out.append(first ? "{\"id\": " : ", {\"id\": ");
+            out.append(node.id);
+            out.append(node.isLeaf() ? ", \"value\": " : ", \"op\": ");
+            out.append(jsonString(nodeName(node)));
+            if (node.left() != -1) {
+                out.append(", \"left\": ");
+                out.append(node.left());
+            }
+            if (node.right() != -1) {
+                out.append(", \"right\": ");
+                out.append(node.right());
+            }
+            out.append(", \"aliases\": [");
+            appendAliases(node, true);
+            out.append("]}");
+            first = false;
+        }
+        out.append("], \"variables\": {");
+        first = true;
+        for (SymbolId var : variables) {
+            if (!selected(varToNode[var])) continue;
+            if (!first) out.append(", ");
+            out.append(jsonString(symbols->name(var)));
+            out.append(": ");
+            out.append(varToNode[var]);
+            first = false;
+        }
+        out.append("}}\n");
+        return;
+    }
+    
+    out.append("DAG Structure:\n");
+    for (size_t id = firstNode; id < count && id <= lastNode; ++id) {
+        if (!selected(id)) continue;
+        DAGNode node(nodes, id);
+        out.append("Node ");
+        out.append(node.id);
+        out.append(": op=");
+        out.append(nodeName(node));
+        if (node.left() != -1) {
+            out.append(", left=");
+            out.append(node.left());
+        }
+        if (node.right() != -1) {
+            out.append(", right=");
+            out.append(node.right());
+        }
+        out.append(", aliases=[");
+        appendAliases(node, false);
+        out.append("]\n");
+    }
+    
+    out.append("Variable to Node mappings:\n");
+    for (SymbolId var : variables) {
+        if (!selected(varToNode[var])) continue;
+        out.append(symbols->name(var));
+        out.append(" -> Node ");
+        out.append(varToNode[var]);
+        out.append("\n");
+    }
+    
+    size_t nodeBytes = nodes.memoryBytes();
+    size_t tableBytes = exprToNode.memoryBytes();
+    size_t total = memoryBytes();
+    char perNode[32];
+    std::snprintf(perNode, sizeof(perNode), "%g", nodes.empty() ? 0.0 : static_cast<double>(total) / nodes.size());
+    out.append(nodes.compact ? "Memory (compact aliases): " : "Memory (linked aliases): ");
+    out.append(count);
+    out.append(" nodes, ");
+    out.append(nodes.bindingCount());
+    out.append(" bindings; DAG ");
+    out.append(nodeBytes);
+    out.append(" bytes, expression table ");
+    out.append(tableBytes);
+    out.append(" bytes, variable maps ");
+    out.append(total - nodeBytes - tableBytes);
+    out.append(" bytes; ");
+    out.append(perNode);
+    out.append(" bytes per node\n");
+}
+
+void DAGOptimizer::printDAG() {
+    std::cout.flush();
+    BufferedWriter out(STDOUT_FILENO);
+    exportDAG(out);
+}
+
+std::string_view trimField(std::string_view field) {
+    // Fields are a few bytes long; a plain loop beats find_first_not_of here.
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+    const char* first = field.data();
+    const char* last = first + field.size();
+    while (first != last && isSpace(*first)) ++first;
+    while (last != first && isSpace(last[-1])) --last;
+    return first == last ? std::string_view() : std::string_view(first, last - first);
+}
+
+size_t highestTemporary(std::string_view text) {
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    size_t highest = 0;
+    for (size_t pos = text.find("_t"); pos != std::string_view::npos; pos = text.find("_t", pos + 2)) {
+        size_t before = pos;
+        while (before > 0 && isSpace(text[before - 1])) --before;
+        if (before == 0 || (text[before - 1] != ',' && text[before - 1] != '(')) continue;
+        
+        // internTemporary writes numbers without leading zeros, so _t07 never clashes.
+        const char* digits = text.data() + pos + 2;
+        size_t end = pos + 2;
+        while (end < text.size() && text[end] >= '0' && text[end] <= '9') ++end;
+        size_t after = end;
+        while (after < text.size() && isSpace(text[after])) ++after;
+        if (end == pos + 2 || *digits == '0' || after == text.size() || (text[after] != ',' && text[after] != ')')) {
+            continue;
+        }
+        size_t number = 0;
+        if (std::from_chars(digits, text.data() + end, number).ec == std::errc()) highest = std::max(highest, number);
+    }
+    return highest;
+}
+
+std::string jsonString(std::string_view text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+bool splitQuadrupleLine(std::string_view line, std::string_view (&parts)[4]) {
+    if (line.empty()) return false;
+    
+    size_t start = line.find('(');
+    size_t end = line.find(')');
+    if (start == std::string_view::npos || end == std::string_view::npos) return false;
+    
+    std::string_view quadData = line.substr(start + 1, end - start - 1);
+    
+    for (size_t i = 0; i < 4 && !quadData.empty(); ++i) {
+        size_t comma = quadData.find(',');
+        parts[i] = trimField(quadData.substr(0, comma));
+        quadData = comma == std::string_view::npos ? std::string_view() : quadData.substr(comma + 1);
+    }
+    return true;
+}
+
+bool parseQuadrupleLine(std::string_view line, SymbolTable& symbols, Quadruple& quad) {
+    std::string_view parts[4];
+    if (!splitQuadrupleLine(line, parts)) return false;
+    
+    quad = {symbols.internOpcode(parts[0]), symbols.intern(parts[1]), symbols.intern(parts[2]), symbols.intern(parts[3])};
+    return true;
+}
+
+bool nextLine(std::string_view& buffer, std::string_view& line) {
+    if (buffer.empty()) return false;
+    
+    const char* newline = static_cast<const char*>(std::memchr(buffer.data(), '\n', buffer.size()));
+    size_t length = newline ? newline - buffer.data() : buffer.size();
+    line = buffer.substr(0, length);
+    buffer.remove_prefix(newline ? length + 1 : length);
+    return true;
+}
+
+static uint64_t classifyDelimitersScalar(const char* data, size_t length) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < length; ++i) {
+        char c = data[i];
+        if (c == '\n' || c == '(' || c == ')' || c == ',') mask |= uint64_t(1) << i;
+    }
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static uint32_t delimiterMaskAvx2(const char* data) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    __m256i hits = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('('))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(')')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(','))));
+    return uint32_t(_mm256_movemask_epi8(hits));
+}
+
+__attribute__((target("avx2")))
+static uint64_t classifyDelimitersAvx2(const char* data) {
+    return delimiterMaskAvx2(data) | uint64_t(delimiterMaskAvx2(data + 32)) << 32;
+}
+
+__attribute__((target("sse2")))
+static uint64_t classifyDelimitersSse2(const char* data) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('('))),
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(')')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(','))));
+        mask |= uint64_t(uint16_t(_mm_movemask_epi8(hits))) << (16 * i);
+    }
+    return mask;
+}
+#elif defined(__aarch64__)
+// AArch64 only: 32-bit ARM has no vpaddq_u8 and takes the scalar kernel.
+static uint64_t classifyDelimitersNeon(const char* data) {
+    const uint8x16_t bit = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t hits[4];
+    for (int i = 0; i < 4; ++i) {
+        uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(data + 16 * i));
+        uint8x16_t match = vorrq_u8(vorrq_u8(vceqq_u8(bytes, vdupq_n_u8('\n')), vceqq_u8(bytes, vdupq_n_u8('('))),
+                                    vorrq_u8(vceqq_u8(bytes, vdupq_n_u8(')')), vceqq_u8(bytes, vdupq_n_u8(','))));
+        hits[i] = vandq_u8(match, bit);
+    }
+    // Pairwise adds fold each group of eight lanes into one byte of the mask.
+    uint8x16_t sum = vpaddq_u8(vpaddq_u8(hits[0], hits[1]), vpaddq_u8(hits[2], hits[3]));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+#endif
+
+static uint64_t classifyDelimitersPortable(const char* data) {
+    return classifyDelimitersScalar(data, 64);
+}
+
+// Picks the widest kernel the CPU supports once, at startup.
+static uint64_t (*selectDelimiterKernel())(const char*) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) return classifyDelimitersAvx2;
+    if (__builtin_cpu_supports("sse2")) return classifyDelimitersSse2;
+#elif defined(__aarch64__)
+    return classifyDelimitersNeon;
+#endif
+    return classifyDelimitersPortable;
+}
+
+static uint64_t (*const delimiterKernel)(const char*) = selectDelimiterKernel();
+
+uint64_t classifyDelimiters(const char* data, size_t length) {
+    return length == 64 ? delimiterKernel(data) : classifyDelimitersScalar(data, length);
+}
+
+bool QuadScanner::next(std::string_view (&parts)[4]) {
+    const size_t npos = std::string_view::npos;
+    while (lineStart < size) {
+        // Records the first '(' and ')' of the line and the first four commas between them (or
+        // after the '(' up to the line end when the ')' comes first), as splitQuadrupleLine sees them.
+        size_t open = npos, close = npos;
+        size_t commas[4];
+        int commaCount = 0;
+        size_t lineEnd;
+        for (;;) {
+            size_t position = nextDelimiter();
+            if (position == size || data[position] == '\n') {
+                lineEnd = position;
+                break;
+            }
+            char c = data[position];
+            if (c == '(') {
+                if (open == npos) open = position;
+            } else if (c == ')') {
+                if (close == npos) close = position;
+            } else if (open != npos && (close == npos || close < open) && commaCount < 4) {
+                commas[commaCount++] = position;
+            }
+        }
+        lineStart = lineEnd < size ? lineEnd + 1 : size;
+        if (open == npos || close == npos) continue;
+        
+        size_t end = close > open ? close : lineEnd;
+        size_t fieldStart = open + 1;
+        for (int i = 0; i < 4; ++i) {
+            size_t fieldEnd = i < commaCount ? commas[i] : end;
+            parts[i] = fieldStart < end ? trimField(std::string_view(data + fieldStart, fieldEnd - fieldStart))
+                                        : std::string_view();
+            fieldStart = i < commaCount ? commas[i] + 1 : end;
+        }
+        return true;
+    }
+    return false;
+}
+
+void parseQuadruples(std::string_view buffer, SymbolTable& symbols, std::vector<Quadruple>& quads) {
+    quads.reserve(quads.size() + buffer.size() / 16);
+    
+    QuadScanner scanner(buffer);
+    Quadruple quad;
+    while (scanner.next(symbols, quad)) {
+        quads.push_back(quad);
+    }
+}
+
+std::vector<Quadruple> parseQuadruples(const std::vector<std::string>& lines, SymbolTable& symbols) {
+    std::vector<Quadruple> quads;
+    
+    for (const auto& line : lines) {
+        Quadruple quad;
+        if (parseQuadrupleLine(line, symbols, quad)) {
+            quads.push_back(quad);
+        }
+    }
+    
+    return quads;
+}
+
+void QuadWriter::endSegment() {
+    if (!records.empty()) {
+        uint64_t stringBytes = 0;
+        for (Opcode op : segmentOpcodes) stringBytes += sizeof(uint32_t) + segmentTable->opcodeName(op).size();
+        for (SymbolId id : segmentSymbols) stringBytes += sizeof(uint32_t) + segmentTable->name(id).size();
+        
+        BinaryQuadHeader header;
+        std::memcpy(header.magic, kBinaryQuadMagic, sizeof(header.magic));
+        header.version = kBinaryQuadVersion;
+        header.opcodeCount = segmentOpcodes.size();
+        header.symbolCount = segmentSymbols.size();
+        header.quadCount = records.size();
+        header.stringBytes = stringBytes;
+        append(std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)));
+        
+        for (Opcode op : segmentOpcodes) appendString(segmentTable->opcodeName(op));
+        for (SymbolId id : segmentSymbols) appendString(segmentTable->name(id));
+        static const char padding[4] = {0, 0, 0, 0};
+        append(std::string_view(padding, (4 - stringBytes % 4) % 4));
+        append(std::string_view(reinterpret_cast<const char*>(records.data()),
+                                records.size() * sizeof(BinaryQuadRecord)));
+    }
+    
+    for (SymbolId id : segmentSymbols) symbolSlots[id] = 0;
+    for (Opcode op : segmentOpcodes) opcodeSlots[static_cast<size_t>(op)] = 0;
+    segmentSymbols.clear();
+    segmentOpcodes.clear();
+    records.clear();
+    segmentTable = nullptr;
+}
+
+template <typename T>
+static T readBinaryField(std::string_view& contents) {
+    if (contents.size() < sizeof(T)) throw std::runtime_error("Truncated binary quadruple file");
+    T value;
+    std::memcpy(&value, contents.data(), sizeof(T));
+    contents.remove_prefix(sizeof(T));
+    return value;
+}
+
+void loadBinaryQuadruples(std::string_view contents, SymbolTable& symbols, std::vector<Quadruple>& quads) {
+    std::vector<Opcode> opcodes;
+    std::vector<SymbolId> ids;
+    
+    while (!contents.empty()) {
+        BinaryQuadHeader header = readBinaryField<BinaryQuadHeader>(contents);
+        if (std::memcmp(header.magic, kBinaryQuadMagic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("Bad binary quadruple segment");
+        }
+        if (header.version != kBinaryQuadVersion) {
+            throw std::runtime_error("Unsupported binary quadruple version " + std::to_string(header.version));
+        }
+        
+        opcodes.clear();
+        ids.clear();
+        for (uint64_t i = 0; i < static_cast<uint64_t>(header.opcodeCount) + header.symbolCount; ++i) {
+            uint32_t length = readBinaryField<uint32_t>(contents);
+            if (contents.size() < length) throw std::runtime_error("Truncated binary quadruple file");
+            std::string_view text = contents.substr(0, length);
+            contents.remove_prefix(length);
+            if (i < header.opcodeCount) opcodes.push_back(symbols.internOpcode(text));
+            else ids.push_back(symbols.intern(text));
+        }
+        
+        size_t padding = (4 - header.stringBytes % 4) % 4;
+        if (contents.size() < padding || header.quadCount > (contents.size() - padding) / sizeof(BinaryQuadRecord)) {
+            throw std::runtime_error("Truncated binary quadruple file");
+        }
+        contents.remove_prefix(padding);
+        
+        auto symbol = [&ids](uint32_t index) {
+            if (index == kBinaryNoSymbol) return kNoSymbol;
+            if (index >= ids.size()) throw std::runtime_error("Bad symbol index in binary quadruple file");
+            return ids[index];
+        };
+        
+        quads.reserve(quads.size() + header.quadCount);
+        for (uint64_t i = 0; i < header.quadCount; ++i) {
+            BinaryQuadRecord record = readBinaryField<BinaryQuadRecord>(contents);
+            if (record.op >= opcodes.size()) throw std::runtime_error("Bad opcode index in binary quadruple file");
+            quads.push_back({opcodes[record.op], symbol(record.arg1), symbol(record.arg2), symbol(record.result)});
+        }
+    }
+}
+
+void printQuadruples(const std::vector<Quadruple>& quads, const SymbolTable& symbols) {
+    std::cout.flush();
+    QuadWriter out(STDOUT_FILENO);
+    out.write(quads, symbols);
+}
+
+BlockGraph::BlockGraph(const Quadruple* first, const Quadruple* end, size_t blockSize) {
+    forEachBlock(first, end, blockSize, [&](const Quadruple* blockFirst, const Quadruple* last,
+                                            const Quadruple* control) {
+        blocks.push_back({blockFirst, last, control});
+    });
+    
+    std::unordered_map<SymbolId, int> labelBlock;
+    for (size_t block = 0; block + 1 < blocks.size(); ++block) {
+        const Quadruple* control = blocks[block].control;
+        if (control && control->op == Opcode::Label) labelBlock.emplace(control->result, block + 1);
+    }
+    
+    std::vector<std::vector<int>> successors(blocks.size());
+    predecessors.resize(blocks.size());
+    for (size_t block = 0; block < blocks.size(); ++block) {
+        const Quadruple* control = blocks[block].control;
+        if (control && control->op != Opcode::Label && isControlOpcode(control->op)) {
+            auto target = labelBlock.find(control->result);
+            if (target != labelBlock.end()) successors[block].push_back(target->second);
+        }
+        if (block + 1 < blocks.size() && !(control && control->op == Opcode::Jump)) {
+            successors[block].push_back(block + 1);
+        }
+        for (int successor : successors[block]) predecessors[successor].push_back(block);
+    }
+    
+    computeDominators(successors);
+    visited.assign(blocks.size(), 0);
+}
+
+// Cooper, Harvey and Kennedy's iterative algorithm over a reverse postorder from block 0.
+void BlockGraph::computeDominators(const std::vector<std::vector<int>>& successors) {
+    const int count = blocks.size();
+    std::vector<int> order;
+    std::vector<int> rank(count, -1);
+    std::vector<std::pair<int, size_t>> stack;
+    std::vector<char> seen(count, 0);
+    if (count) {
+        stack.push_back({0, 0});
+        seen[0] = 1;
+    }
+    while (!stack.empty()) {
+        int block = stack.back().first;
+        size_t next = stack.back().second++;
+        if (next < successors[block].size()) {
+            int successor = successors[block][next];
+            if (!seen[successor]) {
+                seen[successor] = 1;
+                stack.push_back({successor, 0});
+            }
+        } else {
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i) rank[order[i]] = i;
+    
+    idom.assign(count, -1);
+    if (!count) return;
+    idom[0] = 0;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (rank[a] > rank[b]) a = idom[a];
+            while (rank[b] > rank[a]) b = idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); ++i) {
+            int block = order[i];
+            int dominator = -1;
+            for (int predecessor : predecessors[block]) {
+                if (idom[predecessor] == -1) continue;
+                dominator = dominator == -1 ? predecessor : intersect(predecessor, dominator);
+            }
+            if (idom[block] != dominator) {
+                idom[block] = dominator;
+                changed = true;
+            }
+        }
+    }
+    idom[0] = -1;
+    
+    children.resize(count);
+    for (int block = 0; block < count; ++block) {
+        if (idom[block] != -1) children[idom[block]].push_back(block);
+    }
+}
+
+void BlockGraph::entryKills(int block, std::vector<SymbolId>& kills) {
+    kills.clear();
+    int dominator = idom[block];
+    if (dominator == -1) return;
+    
+    // Walks backwards from the block without passing its dominator; every reachable block found
+    // this way lies on such a path.
+    ++visitMark;
+    std::vector<int> pending;
+    auto visit = [&](int from) {
+        for (int predecessor : predecessors[from]) {
+            if (predecessor == dominator || visited[predecessor] == visitMark) continue;
+            if (idom[predecessor] == -1 && predecessor != 0) continue;
+            visited[predecessor] = visitMark;
+            pending.push_back(predecessor);
+        }
+    };
+    visit(block);
+    while (!pending.empty()) {
+        int on = pending.back();
+        pending.pop_back();
+        for (const Quadruple* it = blocks[on].first; it != blocks[on].last; ++it) {
+            if (it->result != kNoSymbol) kills.push_back(it->result);
+        }
+        visit(on);
+    }
+}
+
+std::vector<std::vector<SymbolId>> BlockGraph::liveAfter(const SymbolTable& symbols) const {
+    const size_t count = blocks.size();
+    
+    // (variable, block) pairs for what each block reads before writing it and for what it writes.
+    std::vector<std::pair<SymbolId, int>> uses, defs;
+    std::vector<int> read(symbols.size(), -1), written(symbols.size(), -1);
+    for (size_t block = 0; block < count; ++block) {
+        auto onRead = [&](SymbolId var) {
+            if (var == kNoSymbol || symbols.isConstant(var) || written[var] == static_cast<int>(block)
+                || read[var] == static_cast<int>(block)) return;
+            read[var] = block;
+            uses.emplace_back(var, block);
+        };
+        for (const Quadruple* it = blocks[block].first; it != blocks[block].last; ++it) {
+            onRead(it->arg1);
+            onRead(it->arg2);
+            if (it->result != kNoSymbol && written[it->result] != static_cast<int>(block)) {
+                written[it->result] = block;
+                defs.emplace_back(it->result, block);
+            }
+        }
+        const Quadruple* control = blocks[block].control;
+        if (control && control->op != Opcode::Label) {
+            onRead(control->arg1);
+            onRead(control->arg2);
+        }
+    }
+    
+    // Groups the blocks of pairs by variable: those of var are blocksOf[start[var], start[var + 1]).
+    auto group = [&](const std::vector<std::pair<SymbolId, int>>& pairs, std::vector<int>& start,
+                     std::vector<int>& blocksOf) {
+        start.assign(symbols.size() + 1, 0);
+        for (const auto& pair : pairs) ++start[pair.first + 1];
+        for (size_t var = 0; var < symbols.size(); ++var) start[var + 1] += start[var];
+        blocksOf.resize(pairs.size());
+        std::vector<int> next(start.begin(), start.end() - 1);
+        for (const auto& pair : pairs) blocksOf[next[pair.first]++] = pair.second;
+    };
+    std::vector<int> useStart, useBlocks, defStart, defBlocks;
+    group(uses, useStart, useBlocks);
+    group(defs, defStart, defBlocks);
+    
+    // Each variable is live on entry to the blocks that read it first and, walking back from
+    // those, to every block reached before one that writes it. Taking the variables in order keeps
+    // each list sorted, and the walk only visits blocks where the variable is live.
+    std::vector<std::vector<SymbolId>> live(count);
+    std::vector<SymbolId> liveIn(count, kNoSymbol), liveOut(count, kNoSymbol), defined(count, kNoSymbol);
+    std::vector<int> pending;
+    for (SymbolId var = 0; var < static_cast<SymbolId>(symbols.size()); ++var) {
+        if (useStart[var] == useStart[var + 1]) continue;
+        for (int i = defStart[var]; i < defStart[var + 1]; ++i) defined[defBlocks[i]] = var;
+        for (int i = useStart[var]; i < useStart[var + 1]; ++i) {
+            liveIn[useBlocks[i]] = var;
+            pending.push_back(useBlocks[i]);
+        }
+        while (!pending.empty()) {
+            int block = pending.back();
+            pending.pop_back();
+            for (int predecessor : predecessors[block]) {
+                if (liveOut[predecessor] != var) {
+                    liveOut[predecessor] = var;
+                    live[predecessor].push_back(var);
+                }
+                if (defined[predecessor] != var && liveIn[predecessor] != var) {
+                    liveIn[predecessor] = var;
+                    pending.push_back(predecessor);
+                }
+            }
+        }
+    }
+    return live;
+}
+
+std::vector<Quadruple> optimize(const Quadruple* quads, size_t count, SymbolTable& symbols,
+                                const LiveOutSet* liveOut, size_t blockSize, bool acrossBlocks, FoldTarget fold) {
+    struct Collect : BlockHooks {
+        std::vector<Quadruple> result;
+        void output(const std::vector<Quadruple>& block) { result.insert(result.end(), block.begin(), block.end()); }
+    } collect;
+    DAGOptimizer optimizer(symbols);
+    optimizer.setFoldTarget(fold);
+    optimizeBlocks(optimizer, quads, count, symbols, liveOut, blockSize, acrossBlocks, collect);
+    return std::move(collect.result);
+}
+
+size_t propagateCopies(Quadruple* quads, size_t count, const SymbolTable& symbols, const LiveOutSet& liveOut,
+                       size_t blockSize) {
+    // A copy (=, Y, , X) is kept in the scope as the expression (=, X) held by Y.
+    BlockGraph graph(quads, quads + count, blockSize);
+    ValueScope scope;
+    size_t rewritten = 0;
+    auto rewrite = [&](SymbolId& var) {
+        SymbolId source = var != kNoSymbol ? scope.find(Opcode::Assign, var, kNoSymbol) : kNoSymbol;
+        if (source == kNoSymbol) return;
+        var = source;
+        ++rewritten;
+    };
+    forEachBlockInDominatorOrder(graph, scope, [&](int block) {
+        const BlockRange& range = graph.blocks[block];
+        for (Quadruple* quad = quads + (range.first - quads); quad != quads + (range.last - quads); ++quad) {
+            rewrite(quad->arg1);
+            rewrite(quad->arg2);
+            scope.kill(quad->result);
+            if (quad->op == Opcode::Assign && quad->arg1 != quad->result
+                && !liveOut.contains(symbols.name(quad->result))) {
+                scope.add(Opcode::Assign, quad->result, kNoSymbol, quad->arg1);
+            }
+        }
+        if (range.control && range.control->op != Opcode::Label) {
+            Quadruple* control = quads + (range.control - quads);
+            rewrite(control->arg1);
+            rewrite(control->arg2);
+        }
+    });
+    return rewritten;
+}
@@ -0,0 +1,1695 @@
+// DAG-based local optimization of quadruple code: symbol interning, the value-numbering
+// DAG, text and binary quadruple I/O on memory buffers, and optimize() for whole programs.
+// Nothing here touches global mutable state; separate SymbolTable/DAGOptimizer instances can
+// be used from separate threads.
+#ifndef DAGOPT_H
+#define DAGOPT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using SymbolId = int;
+const SymbolId kNoSymbol = -1;
+
+enum class Opcode : uint16_t {
+    None,
+    Assign,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Shl,
+    Shr,
+    BitAnd,
+    BitOr,
+    BitXor,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Eq,
+    Ne,
+    Label,
+    Jump,
+    JumpNz,
+    JumpLt,
+    JumpLe,
+    JumpGt,
+    JumpGe,
+    JumpEq,
+    JumpNe,
+    FirstCustom
+};
+
+inline const std::string kBuiltinOpcodeNames[] = {
+    "", "=", "+", "-", "*", "/",
+    "%", "<<", ">>", "&", "|", "^", "<", "<=", ">", ">=", "==", "!=",
+    "label", "j", "jnz", "j<", "j<=", "j>", "j>=", "j=", "j!="
+};
+
+// FirstCustom when the name is not a builtin opcode.
+inline Opcode builtinOpcode(std::string_view name) {
+    for (size_t i = 0; i < static_cast<size_t>(Opcode::FirstCustom); ++i) {
+        if (name == kBuiltinOpcodeNames[i]) return static_cast<Opcode>(i);
+    }
+    return Opcode::FirstCustom;
+}
+
+// Labels start a basic block and jumps end one; neither takes part in the DAG.
+inline bool isControlOpcode(Opcode op) {
+    return op >= Opcode::Label && op <= Opcode::JumpNe;
+}
+
+// The integers constants fold in: two's complement, bits wide (8, 16, 32 or 64). A fold whose
+// exact result does not fit is left as written unless the target wraps, in which case the
+// result is reduced modulo 2^bits as the target's arithmetic would. Shifts always wrap, and
+// dividing by zero, overflowing a division or shifting out of range never folds.
+struct FoldTarget {
+    unsigned bits = 32;
+    bool wraps = false;
+    
+    constexpr int64_t min() const { return bits >= 64 ? INT64_MIN : -(int64_t(1) << (bits - 1)); }
+    constexpr int64_t max() const { return bits >= 64 ? INT64_MAX : (int64_t(1) << (bits - 1)) - 1; }
+    constexpr bool fits(int64_t value) const { return value >= min() && value <= max(); }
+    
+    constexpr int64_t wrap(uint64_t value) const {
+        if (bits >= 64) return static_cast<int64_t>(value);
+        uint64_t sign = uint64_t(1) << (bits - 1);
+        value &= (sign << 1) - 1;
+        return static_cast<int64_t>(value ^ sign) - static_cast<int64_t>(sign);
+    }
+    
+    // low is the exact result modulo 2^64; overflowed says the exact result needs more bits.
+    constexpr bool narrow(int64_t low, bool overflowed, int64_t& r) const {
+        if ((overflowed || !fits(low)) && !wraps) return false;
+        r = wrap(static_cast<uint64_t>(low));
+        return true;
+    }
+};
+
+// Operands are values of the target; the result is only set when the fold succeeds. Overflow
+// past 64 bits is caught by the checked-arithmetic builtins, so no operation here can overflow.
+using FoldFunction = bool (*)(int64_t, int64_t, int64_t&, FoldTarget);
+
+constexpr bool foldAdd(int64_t a, int64_t b, int64_t& r, FoldTarget t) {
+    int64_t low = 0;
+    bool overflowed = __builtin_add_overflow(a, b, &low);
+    return t.narrow(low, overflowed, r);
+}
+constexpr bool foldSub(int64_t a, int64_t b, int64_t& r, FoldTarget t) {
+    int64_t low = 0;
+    bool overflowed = __builtin_sub_overflow(a, b, &low);
+    return t.narrow(low, overflowed, r);
+}
+constexpr bool foldMul(int64_t a, int64_t b, int64_t& r, FoldTarget t) {
+    int64_t low = 0;
+    bool overflowed = __builtin_mul_overflow(a, b, &low);
+    return t.narrow(low, overflowed, r);
+}
+constexpr bool foldDiv(int64_t a, int64_t b, int64_t& r, FoldTarget t) {
+    if (b == 0 || (a == INT64_MIN && b == -1) || !t.fits(a / b)) return false;
+    r = a / b;
+    return true;
+}
+constexpr bool foldMod(int64_t a, int64_t b, int64_t& r, FoldTarget) {
+    if (b == 0) return false;
+    r = b == -1 ? 0 : a % b;
+    return true;
+}
+constexpr bool foldShl(int64_t a, int64_t b, int64_t& r, FoldTarget t) {
+    if (b < 0 || b >= static_cast<int64_t>(t.bits)) return false;
+    r = t.wrap(static_cast<uint64_t>(a) << b);
+    return true;
+}
+constexpr bool foldShr(int64_t a, int64_t b, int64_t& r, FoldTarget t) {
+    if (b < 0 || b >= static_cast<int64_t>(t.bits)) return false;
+    r = a >> b;
+    return true;
+}
+constexpr bool foldAnd(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a & b; return true; }
+constexpr bool foldOr(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a | b; return true; }
+constexpr bool foldXor(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a ^ b; return true; }
+constexpr bool foldLt(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a < b; return true; }
+constexpr bool foldLe(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a <= b; return true; }
+constexpr bool foldGt(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a > b; return true; }
+constexpr bool foldGe(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a >= b; return true; }
+constexpr bool foldEq(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a == b; return true; }
+constexpr bool foldNe(int64_t a, int64_t b, int64_t& r, FoldTarget) { r = a != b; return true; }
+
+constexpr FoldFunction kFoldTable[] = {
+    nullptr, nullptr, foldAdd, foldSub, foldMul, foldDiv,
+    foldMod, foldShl, foldShr, foldAnd, foldOr, foldXor,
+    foldLt, foldLe, foldGt, foldGe, foldEq, foldNe
+};
+
+constexpr FoldFunction foldFunction(Opcode op) {
+    size_t index = static_cast<size_t>(op);
+    return index < sizeof(kFoldTable) / sizeof(kFoldTable[0]) ? kFoldTable[index] : nullptr;
+}
+
+static_assert(foldFunction(Opcode::Ne) == foldNe, "kFoldTable must follow the Opcode order");
+
+// The opcode computing the same value with the operands swapped: itself for commutative
+// operators, the mirrored comparison for orderings, None when operand order matters.
+constexpr Opcode swappedOpcode(Opcode op) {
+    switch (op) {
+    case Opcode::Add: case Opcode::Mul: case Opcode::BitAnd: case Opcode::BitOr:
+    case Opcode::BitXor: case Opcode::Eq: case Opcode::Ne:
+        return op;
+    case Opcode::Lt: return Opcode::Gt;
+    case Opcode::Gt: return Opcode::Lt;
+    case Opcode::Le: return Opcode::Ge;
+    case Opcode::Ge: return Opcode::Le;
+    default: return Opcode::None;
+    }
+}
+
+// Identities with one constant operand: when the operand on `side` equals `operand`, the
+// expression is either the other operand or the constant `value`.
+enum class RuleSide : uint8_t { Left, Right, Either };
+enum class RuleResult : uint8_t { Other, Constant };
+
+struct IdentityRule {
+    Opcode op;
+    RuleSide side;
+    int64_t operand;
+    RuleResult result;
+    int64_t value;
+};
+
+constexpr IdentityRule kIdentityRules[] = {
+    {Opcode::Add, RuleSide::Either, 0, RuleResult::Other, 0},
+    {Opcode::Sub, RuleSide::Right, 0, RuleResult::Other, 0},
+    {Opcode::Mul, RuleSide::Either, 1, RuleResult::Other, 0},
+    {Opcode::Mul, RuleSide::Either, 0, RuleResult::Constant, 0},
+    {Opcode::Div, RuleSide::Right, 1, RuleResult::Other, 0},
+    {Opcode::Mod, RuleSide::Right, 1, RuleResult::Constant, 0},
+    {Opcode::Shl, RuleSide::Right, 0, RuleResult::Other, 0},
+    {Opcode::Shr, RuleSide::Right, 0, RuleResult::Other, 0},
+    {Opcode::BitAnd, RuleSide::Either, 0, RuleResult::Constant, 0},
+    {Opcode::BitAnd, RuleSide::Either, -1, RuleResult::Other, 0},
+    {Opcode::BitOr, RuleSide::Either, 0, RuleResult::Other, 0},
+    {Opcode::BitOr, RuleSide::Either, -1, RuleResult::Constant, -1},
+    {Opcode::BitXor, RuleSide::Either, 0, RuleResult::Other, 0},
+};
+
+// Identities of an operator applied to one value twice.
+struct SelfRule {
+    Opcode op;
+    RuleResult result;
+    int64_t value;
+};
+
+constexpr SelfRule kSelfRules[] = {
+    {Opcode::Sub, RuleResult::Constant, 0},
+    {Opcode::BitAnd, RuleResult::Other, 0},
+    {Opcode::BitOr, RuleResult::Other, 0},
+    {Opcode::BitXor, RuleResult::Constant, 0},
+    {Opcode::Lt, RuleResult::Constant, 0},
+    {Opcode::Le, RuleResult::Constant, 1},
+    {Opcode::Gt, RuleResult::Constant, 0},
+    {Opcode::Ge, RuleResult::Constant, 1},
+    {Opcode::Eq, RuleResult::Constant, 1},
+    {Opcode::Ne, RuleResult::Constant, 0},
+};
+
+enum class SymbolKind : uint8_t {
+    Name,
+    Constant,
+    Immediate
+};
+
+// Integer literals are parsed once at intern time. Those that fit 64 bits carry an immediate
+// (folded only if it also fits the optimizer's FoldTarget); wider literals stay constants but
+// are never folded.
+inline SymbolKind classifySymbol(std::string_view name, int64_t& value) {
+    value = 0;
+    size_t digits = name[0] == '-' ? 1 : 0;
+    if (digits < name.size() && std::all_of(name.begin() + digits, name.end(),
+            [](char c) { return c >= '0' && c <= '9'; })) {
+        auto parsed = std::from_chars(name.data(), name.data() + name.size(), value);
+        return parsed.ec == std::errc() ? SymbolKind::Immediate : SymbolKind::Constant;
+    }
+    return SymbolKind::Name;
+}
+
+// Names interned once for all the blocks of a file that are optimized in parallel, so workers
+// do not each copy and classify the same names. Lookups and inserts take no lock: a slot is
+// claimed with one compare-and-swap, and entries never move or die while the table lives.
+// Past three quarters of its capacity the table is full and findOrInsert returns nullptr. An
+// insert reserves its place in count before claiming a slot, so racing inserts cannot overfill
+// the table and every probe ends at an empty slot.
+class SharedSymbolTable {
+public:
+    struct Entry {
+        std::string name;
+        size_t hash;
+        SymbolKind kind;
+        int64_t immediate;
+    };
+    
+private:
+    std::unique_ptr<std::atomic<Entry*>[]> slots;
+    size_t mask;
+    size_t limit;
+    std::atomic<size_t> count{0};
+    
+public:
+    explicit SharedSymbolTable(size_t capacity) {
+        size_t size = 16;
+        while (size < capacity) size *= 2;
+        slots.reset(new std::atomic<Entry*>[size]);
+        for (size_t i = 0; i < size; ++i) slots[i].store(nullptr, std::memory_order_relaxed);
+        mask = size - 1;
+        limit = size / 4 * 3;
+    }
+    
+    ~SharedSymbolTable() {
+        for (size_t i = 0; i <= mask; ++i) delete slots[i].load(std::memory_order_relaxed);
+    }
+    
+    SharedSymbolTable(const SharedSymbolTable&) = delete;
+    SharedSymbolTable& operator=(const SharedSymbolTable&) = delete;
+    
+    const Entry* find(std::string_view name) const {
+        size_t hash = std::hash<std::string_view>()(name);
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Entry* entry = slots[i].load(std::memory_order_acquire);
+            if (!entry) return nullptr;
+            if (entry->hash == hash && entry->name == name) return entry;
+        }
+    }
+    
+    const Entry* findOrInsert(std::string_view name) {
+        size_t hash = std::hash<std::string_view>()(name);
+        std::unique_ptr<Entry> created;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            Entry* entry = slots[i].load(std::memory_order_acquire);
+            if (!entry) {
+                if (count.fetch_add(1, std::memory_order_relaxed) >= limit) {
+                    count.fetch_sub(1, std::memory_order_relaxed);
+                    return nullptr;
+                }
+                if (!created) {
+                    int64_t value;
+                    SymbolKind kind = classifySymbol(name, value);
+                    created.reset(new Entry{std::string(name), hash, kind, value});
+                }
+                if (slots[i].compare_exchange_strong(entry, created.get(), std::memory_order_acq_rel)) {
+                    return created.release();
+                }
+                count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (entry->hash == hash && entry->name == name) return entry;
+        }
+    }
+    
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+};
+
+// Ids are dense and handed out in order of first appearance. A table backed by a
+// SharedSymbolTable takes names, kinds and immediates from it and only keeps their local ids,
+// which match the ids an unshared table would give the same input.
+class SymbolTable {
+private:
+    using SharedEntry = SharedSymbolTable::Entry;
+    
+    std::vector<const std::string*> names;
+    std::vector<SymbolKind> kinds;
+    std::vector<int64_t> immediates;
+    std::deque<std::string> ownNames;
+    std::unordered_map<std::string_view, SymbolId> ids;
+    std::deque<std::string> customOpcodes;
+    std::unordered_map<std::string_view, Opcode> opcodeIds;
+    size_t temporaryCount = 0;
+    
+    // Local ids of shared entries, open addressing on the entry's name hash.
+    SharedSymbolTable* shared = nullptr;
+    std::vector<std::pair<const SharedEntry*, SymbolId>> sharedIds;
+    size_t sharedIdCount = 0;
+
+public:
+    explicit SymbolTable(SharedSymbolTable* sharedTable = nullptr) : shared(sharedTable) {}
+    
+    Opcode internOpcode(std::string_view name) {
+        Opcode builtin = builtinOpcode(name);
+        if (builtin != Opcode::FirstCustom) return builtin;
+
+        auto it = opcodeIds.find(name);
+        if (it != opcodeIds.end()) return it->second;
+
+        // Opcodes are 16 bits; wrapping around would give a custom name the rules of a builtin.
+        size_t id = static_cast<size_t>(Opcode::FirstCustom) + customOpcodes.size();
+        if (id > UINT16_MAX) throw std::runtime_error("Too many distinct opcodes, at " + std::string(name));
+        Opcode op = static_cast<Opcode>(id);
+        customOpcodes.emplace_back(name);
+        opcodeIds.emplace(customOpcodes.back(), op);
+        return op;
+    }
+
+    const std::string& opcodeName(Opcode op) const {
+        size_t index = static_cast<size_t>(op);
+        if (index < static_cast<size_t>(Opcode::FirstCustom)) return kBuiltinOpcodeNames[index];
+        return customOpcodes[index - static_cast<size_t>(Opcode::FirstCustom)];
+    }
+
+    SymbolId intern(std::string_view name) {
+        if (name.empty()) return kNoSymbol;
+        
+        SymbolId id = find(name);
+        if (id != kNoSymbol) return id;
+        
+        // A name the shared table has no room for stays local, like every name of an unshared table.
+        if (shared) {
+            if (const SharedEntry* entry = shared->findOrInsert(name)) {
+                SymbolId& local = sharedId(entry);
+                local = names.size();
+                names.push_back(&entry->name);
+                kinds.push_back(entry->kind);
+                immediates.push_back(entry->immediate);
+                return local;
+            }
+        }
+        int64_t value;
+        SymbolKind kind = classifySymbol(name, value);
+        return add(name, kind, value);
+    }
+
+    SymbolId internConstant(int64_t value) {
+        char buffer[24];
+        auto formatted = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        std::string_view name(buffer, formatted.ptr - buffer);
+
+        SymbolId id = find(name);
+        if (id != kNoSymbol) return id;
+        return add(name, SymbolKind::Immediate, value);
+    }
+
+    // Temporaries are numbered past _t<count>, for a table that holds one block of a larger input
+    // whose other blocks may use names up to that one (see highestTemporary). Until clear().
+    void reserveTemporaries(size_t count) { temporaryCount = std::max(temporaryCount, count); }
+
+    // A name that does not occur in the input, for values whose every alias was overwritten.
+    SymbolId internTemporary() {
+        std::string name;
+        do {
+            name = "_t" + std::to_string(++temporaryCount);
+        } while (find(name) != kNoSymbol);
+        return add(name, SymbolKind::Name, 0);
+    }
+
+    const std::string& name(SymbolId id) const {
+        static const std::string empty;
+        return id == kNoSymbol ? empty : *names[id];
+    }
+
+    bool isConstant(SymbolId id) const { return id != kNoSymbol && kinds[id] != SymbolKind::Name; }
+
+    bool hasImmediate(SymbolId id) const { return id != kNoSymbol && kinds[id] == SymbolKind::Immediate; }
+
+    int64_t immediate(SymbolId id) const { return immediates[id]; }
+
+    size_t size() const { return names.size(); }
+
+    // The id of name, or kNoSymbol if it has not been interned.
+    SymbolId find(std::string_view name) const {
+        if (!ids.empty()) {
+            auto it = ids.find(name);
+            if (it != ids.end()) return it->second;
+        }
+        if (!shared || !sharedIdCount) return kNoSymbol;
+        const SharedEntry* entry = shared->find(name);
+        if (!entry) return kNoSymbol;
+        size_t mask = sharedIds.size() - 1;
+        for (size_t i = entry->hash & mask;; i = (i + 1) & mask) {
+            if (sharedIds[i].first == entry) return sharedIds[i].second;
+            if (!sharedIds[i].first) return kNoSymbol;
+        }
+    }
+    
+    // Keeps every allocation for the next input, except buckets the last one left mostly empty:
+    // clearing the map visits each of them.
+    void clear() {
+        bool sparse = ids.bucket_count() > 4 * ids.size() + 1024;
+        ids.clear();
+        if (sparse) ids.rehash(0);
+        names.clear();
+        kinds.clear();
+        immediates.clear();
+        ownNames.clear();
+        if (sharedIdCount) {
+            std::fill(sharedIds.begin(), sharedIds.end(), std::pair<const SharedEntry*, SymbolId>(nullptr, kNoSymbol));
+            sharedIdCount = 0;
+        }
+        temporaryCount = 0;
+    }
+
+private:
+    SymbolId add(std::string_view name, SymbolKind kind, int64_t value) {
+        SymbolId id = names.size();
+        ownNames.emplace_back(name);
+        names.push_back(&ownNames.back());
+        kinds.push_back(kind);
+        immediates.push_back(value);
+        ids.emplace(ownNames.back(), id);
+        return id;
+    }
+    
+    // The slot for entry's local id, claimed for it if it has none yet.
+    SymbolId& sharedId(const SharedEntry* entry) {
+        if ((sharedIdCount + 1) * 2 > sharedIds.size()) {
+            std::vector<std::pair<const SharedEntry*, SymbolId>> old(std::max<size_t>(16, sharedIds.size() * 2),
+                                                                     {nullptr, kNoSymbol});
+            old.swap(sharedIds);
+            size_t mask = sharedIds.size() - 1;
+            for (const auto& slot : old) {
+                if (!slot.first) continue;
+                size_t i = slot.first->hash & mask;
+                while (sharedIds[i].first) i = (i + 1) & mask;
+                sharedIds[i] = slot;
+            }
+        }
+        size_t mask = sharedIds.size() - 1;
+        for (size_t i = entry->hash & mask;; i = (i + 1) & mask) {
+            if (sharedIds[i].first == entry) return sharedIds[i].second;
+            if (!sharedIds[i].first) {
+                sharedIds[i] = {entry, kNoSymbol};
+                ++sharedIdCount;
+                return sharedIds[i].second;
+            }
+        }
+    }
+};
+
+struct Quadruple {
+    Opcode op;
+    SymbolId arg1;
+    SymbolId arg2;
+    SymbolId result;
+    
+    Quadruple(Opcode o = Opcode::None, SymbolId a1 = kNoSymbol, SymbolId a2 = kNoSymbol, SymbolId r = kNoSymbol)
+        : op(o), arg1(a1), arg2(a2), result(r) {}
+};
+
+// Quads without a result, such as (param, t, , ) or (print, x, , ), are only there for their
+// effects: like control quads they are copied through in place and end a basic block.
+inline bool endsBlock(const Quadruple& quad) {
+    return isControlOpcode(quad.op) || quad.result == kNoSymbol;
+}
+
+// Aliases of a node form a doubly linked list threaded through one shared pool, in the order
+// they were added, so a variable that is reassigned can be unlinked from its old node in O(1).
+struct AliasLink {
+    SymbolId symbol;
+    int prev;
+    int next;
+};
+
+// The DAG as parallel arrays: opcode, left and right are what every pass walks, so they stay
+// dense; leaf values and alias bookkeeping sit in their own columns. Clearing keeps the
+// capacity of every column, so a block's graph is released in O(1) and refilled without
+// allocating.
+//
+// In compact mode there are no alias links while the block is built: bindings are only logged,
+// and packAliases() later writes each node's aliases as varint symbol ids into one byte pool,
+// in the order the linked lists would hold them.
+struct NodeStore {
+    std::vector<Opcode> opcode;
+    std::vector<int> left;
+    std::vector<int> right;
+    std::vector<int> firstAlias;
+    std::vector<int> lastAlias;
+    std::vector<SymbolId> value;
+    std::vector<SymbolId> home;
+    std::vector<AliasLink> aliasPool;
+    
+    bool compact = false;
+    std::vector<SymbolId> bindings;
+    std::vector<uint8_t> packedAliases;
+    std::vector<uint32_t> packedStart;
+    
+    size_t size() const { return opcode.size(); }
+    bool empty() const { return opcode.empty(); }
+    
+    int add(Opcode op, int l = -1, int r = -1) {
+        int id = opcode.size();
+        opcode.push_back(op);
+        left.push_back(l);
+        right.push_back(r);
+        if (!compact) {
+            firstAlias.push_back(-1);
+            lastAlias.push_back(-1);
+        }
+        value.push_back(kNoSymbol);
+        home.push_back(kNoSymbol);
+        return id;
+    }
+    
+    // Returns the binding's link, or in compact mode its index in the log.
+    int addAlias(int node, SymbolId alias) {
+        if (compact) {
+            bindings.push_back(alias);
+            return bindings.size() - 1;
+        }
+        int link = aliasPool.size();
+        aliasPool.push_back({alias, lastAlias[node], -1});
+        if (lastAlias[node] == -1) firstAlias[node] = link;
+        else aliasPool[lastAlias[node]].next = link;
+        lastAlias[node] = link;
+        return link;
+    }
+    
+    // The link stays in the pool as garbage until clear(). A compact store drops the binding
+    // when it packs, as it is no longer the variable's latest.
+    void removeAlias(int node, int link) {
+        if (compact) return;
+        const AliasLink& dead = aliasPool[link];
+        if (dead.prev == -1) firstAlias[node] = dead.next;
+        else aliasPool[dead.prev].next = dead.next;
+        if (dead.next == -1) lastAlias[node] = dead.prev;
+        else aliasPool[dead.next].prev = dead.prev;
+    }
+    
+    size_t bindingCount() const { return compact ? bindings.size() : aliasPool.size(); }
+    
+    // Packs the latest binding of every variable: nodeOf and latest give each variable's node
+    // and the log index of its binding to it.
+    void packAliases(const std::vector<int>& nodeOf, const std::vector<int>& latest) {
+        auto varintBytes = [](uint32_t v) { return v < (1u << 7) ? 1 : v < (1u << 14) ? 2 : v < (1u << 21) ? 3 : v < (1u << 28) ? 4 : 5; };
+        packedStart.assign(size() + 1, 0);
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            SymbolId var = bindings[i];
+            if (latest[var] == static_cast<int>(i)) packedStart[nodeOf[var] + 1] += varintBytes(var);
+        }
+        for (size_t node = 0; node < size(); ++node) packedStart[node + 1] += packedStart[node];
+        packedAliases.resize(packedStart[size()]);
+        
+        // Fills each node's range with packedStart[node] as its cursor, then shifts the starts back.
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            uint32_t var = bindings[i];
+            if (latest[var] != static_cast<int>(i)) continue;
+            uint32_t& cursor = packedStart[nodeOf[var]];
+            for (; var >= 0x80; var >>= 7) packedAliases[cursor++] = static_cast<uint8_t>(var | 0x80);
+            packedAliases[cursor++] = static_cast<uint8_t>(var);
+        }
+        for (size_t node = size(); node > 0; --node) packedStart[node] = packedStart[node - 1];
+        packedStart[0] = 0;
+    }
+    
+    size_t memoryBytes() const {
+        auto bytes = [](const auto& column) { return column.capacity() * sizeof(column[0]); };
+        return bytes(opcode) + bytes(left) + bytes(right) + bytes(firstAlias) + bytes(lastAlias) + bytes(value)
+             + bytes(home) + bytes(aliasPool) + bytes(bindings) + bytes(packedAliases) + bytes(packedStart);
+    }
+    
+    void reserve(size_t nodes, size_t aliases) {
+        opcode.reserve(nodes);
+        left.reserve(nodes);
+        right.reserve(nodes);
+        value.reserve(nodes);
+        home.reserve(nodes);
+        if (compact) {
+            bindings.reserve(aliases);
+        } else {
+            firstAlias.reserve(nodes);
+            lastAlias.reserve(nodes);
+            aliasPool.reserve(aliases);
+        }
+    }
+    
+    void clear() {
+        opcode.clear();
+        left.clear();
+        right.clear();
+        firstAlias.clear();
+        lastAlias.clear();
+        value.clear();
+        home.clear();
+        aliasPool.clear();
+        bindings.clear();
+        packedAliases.clear();
+        packedStart.clear();
+    }
+};
+
+// Read-only view of one node in a NodeStore. A compact store must have been packed.
+class DAGNode {
+private:
+    const NodeStore* store;
+
+public:
+    int id;
+    
+    DAGNode(const NodeStore& nodes, int i) : store(&nodes), id(i) {}
+    
+    Opcode op() const { return store->opcode[id]; }
+    int left() const { return store->left[id]; }
+    int right() const { return store->right[id]; }
+    SymbolId value() const { return store->value[id]; }
+    
+    // Only leaves carry a value; an operation without operands, such as (foo, , , X), does not.
+    bool isLeaf() const { return value() != kNoSymbol; }
+    
+    bool hasAliases() const {
+        return store->compact ? store->packedStart[id] != store->packedStart[id + 1] : store->firstAlias[id] != -1;
+    }
+    
+    SymbolId primaryAlias() const {
+        SymbolId primary = kNoSymbol;
+        forEachAlias([&](SymbolId alias) {
+            if (primary == kNoSymbol) primary = alias;
+        });
+        return primary;
+    }
+    
+    template <typename Fn>
+    void forEachAlias(Fn fn) const {
+        if (store->compact) {
+            const uint8_t* it = store->packedAliases.data() + store->packedStart[id];
+            const uint8_t* end = store->packedAliases.data() + store->packedStart[id + 1];
+            while (it != end) {
+                uint32_t symbol = 0;
+                for (int shift = 0;; shift += 7) {
+                    uint8_t byte = *it++;
+                    symbol |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                    if (!(byte & 0x80)) break;
+                }
+                fn(static_cast<SymbolId>(symbol));
+            }
+            return;
+        }
+        for (int link = store->firstAlias[id]; link != -1; link = store->aliasPool[link].next) {
+            fn(store->aliasPool[link].symbol);
+        }
+    }
+};
+
+// Shell-style wildcard match supporting '*', '?' and '[...]' classes ('[!...]' negates).
+bool globMatch(std::string_view pattern, std::string_view name);
+
+// Variables whose final values are read after the block. Listed names are always live,
+// names matching tempPattern are dead unless listed, and any other name is live only when
+// no explicit list was given.
+struct LiveOutSet {
+    std::unordered_set<std::string> variables;
+    std::string tempPattern = "T[0-9]*";
+    
+    bool contains(const std::string& name) const {
+        if (variables.count(name)) return true;
+        if (globMatch(tempPattern, name)) return false;
+        return variables.empty();
+    }
+};
+
+class NodeBitset {
+private:
+    std::vector<uint64_t> words;
+
+public:
+    explicit NodeBitset(size_t size) : words((size + 63) / 64, 0) {}
+    
+    void set(size_t index) { words[index >> 6] |= uint64_t(1) << (index & 63); }
+    bool test(size_t index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+};
+
+// Value-numbering table keyed on (opcode, left, right), open addressing with linear probing.
+// A slot is only in use if it was filled in the current epoch, so clear() is a counter bump
+// however large the table has grown.
+class ExprTable {
+private:
+    struct Slot {
+        uint64_t operands;
+        uint16_t op;
+        uint16_t epoch;
+        int node;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+    uint16_t epoch = 1;
+    double peak = 0;
+
+    static uint64_t pack(int left, int right) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(left)) << 32) | static_cast<uint32_t>(right);
+    }
+
+    static size_t hash(uint16_t op, uint64_t operands) {
+        uint64_t h = operands ^ (static_cast<uint64_t>(op) * 0x9E3779B97F4A7C15ULL);
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+
+    void resize(size_t size) {
+        peak = std::max(peak, load());
+        std::vector<Slot> old(size, Slot{0, 0, 0, -1});
+        old.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const auto& slot : old) {
+            if (slot.epoch != epoch) continue;
+            size_t i = hash(slot.op, slot.operands) & mask;
+            while (slots[i].epoch == epoch) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+    
+    void grow() { resize(std::max<size_t>(16, slots.size() * 2)); }
+
+public:
+    // Returns the node registered for (op, left, right); registers newNode if there is none.
+    int findOrInsert(Opcode op, int left, int right, int newNode) {
+        if ((count + 1) * 2 > slots.size()) grow();
+
+        uint16_t code = static_cast<uint16_t>(op);
+        uint64_t operands = pack(left, right);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(code, operands) & mask;; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.epoch != epoch) {
+                slot = Slot{operands, code, epoch, newNode};
+                ++count;
+                return newNode;
+            }
+            if (slot.operands == operands && slot.op == code) return slot.node;
+        }
+    }
+    
+    // The node registered for (op, left, right), or -1.
+    int find(Opcode op, int left, int right) const {
+        if (slots.empty()) return -1;
+        uint16_t code = static_cast<uint16_t>(op);
+        uint64_t operands = pack(left, right);
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(code, operands) & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.epoch != epoch) return -1;
+            if (slot.operands == operands && slot.op == code) return slot.node;
+        }
+    }
+    
+    double load() const { return slots.empty() ? 0.0 : static_cast<double>(count) / slots.size(); }
+    
+    size_t memoryBytes() const { return slots.capacity() * sizeof(Slot); }
+    
+    // Highest load seen since construction or resetPeak(), across clears.
+    double peakLoad() const { return std::max(peak, load()); }
+    
+    void resetPeak() { peak = 0; }
+    
+    // Sizes the table to hold that many expressions without growing.
+    void reserve(size_t expressions) {
+        size_t size = 16;
+        while (size < expressions * 2) size *= 2;
+        if (size > slots.size()) resize(size);
+    }
+    
+    void clear() {
+        if (count == 0) return;
+        peak = std::max(peak, load());
+        count = 0;
+        if (++epoch == 0) {
+            std::fill(slots.begin(), slots.end(), Slot{0, 0, 0, -1});
+            epoch = 1;
+        }
+    }
+};
+
+// Expressions available on entry to a block when value numbering spans a dominator tree:
+// (op, arg1, arg2) -> holder says holder has the value of op applied to arg1 and arg2 as
+// they are now. An entry dies once any of its symbols is killed (written) after it was added.
+// enter() and leave() nest like the tree, and leave() undoes every entry and kill made since
+// the matching enter(), so only a block's dominators' entries are ever visible.
+class ValueScope {
+private:
+    struct Key {
+        uint16_t op;
+        SymbolId arg1;
+        SymbolId arg2;
+        
+        bool operator==(const Key& other) const {
+            return op == other.op && arg1 == other.arg1 && arg2 == other.arg2;
+        }
+    };
+    
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t h = (static_cast<uint64_t>(static_cast<uint32_t>(key.arg1)) << 32 | static_cast<uint32_t>(key.arg2))
+                       ^ (static_cast<uint64_t>(key.op) * 0x9E3779B97F4A7C15ULL);
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 33;
+            return static_cast<size_t>(h);
+        }
+    };
+    
+    struct Entry {
+        SymbolId holder;
+        uint64_t stamp;
+    };
+    
+    // previous.holder is kNoSymbol when the key had no entry.
+    struct AddedEntry {
+        Key key;
+        Entry previous;
+    };
+    
+    struct Kill {
+        SymbolId var;
+        uint64_t previous;
+    };
+    
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::vector<uint64_t> killedAt;
+    std::vector<AddedEntry> added;
+    std::vector<Kill> kills;
+    std::vector<std::pair<size_t, size_t>> marks;
+    uint64_t clock = 0;
+    
+    // Commutative operators and orderings are keyed lowest symbol first, as in findOrRegisterExpr.
+    static Key key(Opcode op, SymbolId arg1, SymbolId arg2) {
+        if (arg2 != kNoSymbol && arg1 > arg2 && swappedOpcode(op) != Opcode::None) {
+            return Key{static_cast<uint16_t>(swappedOpcode(op)), arg2, arg1};
+        }
+        return Key{static_cast<uint16_t>(op), arg1, arg2};
+    }
+    
+    uint64_t killStamp(SymbolId var) const {
+        return var == kNoSymbol || var >= static_cast<int>(killedAt.size()) ? 0 : killedAt[var];
+    }
+    
+public:
+    void enter() { marks.push_back({added.size(), kills.size()}); }
+    
+    void leave() {
+        auto [addedMark, killMark] = marks.back();
+        marks.pop_back();
+        for (; added.size() > addedMark; added.pop_back()) {
+            const AddedEntry& undo = added.back();
+            if (undo.previous.holder == kNoSymbol) entries.erase(undo.key);
+            else entries[undo.key] = undo.previous;
+        }
+        for (; kills.size() > killMark; kills.pop_back()) {
+            killedAt[kills.back().var] = kills.back().previous;
+        }
+    }
+    
+    void kill(SymbolId var) {
+        if (var == kNoSymbol) return;
+        if (var >= static_cast<int>(killedAt.size())) killedAt.resize(var + 1, 0);
+        kills.push_back({var, killedAt[var]});
+        killedAt[var] = ++clock;
+    }
+    
+    void add(Opcode op, SymbolId arg1, SymbolId arg2, SymbolId holder) {
+        Key k = key(op, arg1, arg2);
+        auto it = entries.try_emplace(k, Entry{kNoSymbol, 0}).first;
+        added.push_back({k, it->second});
+        it->second = Entry{holder, ++clock};
+    }
+    
+    // The variable holding op(arg1, arg2), or kNoSymbol.
+    SymbolId find(Opcode op, SymbolId arg1, SymbolId arg2) const {
+        auto it = entries.find(key(op, arg1, arg2));
+        if (it == entries.end()) return kNoSymbol;
+        const Entry& entry = it->second;
+        if (entry.holder == kNoSymbol || killStamp(arg1) > entry.stamp || killStamp(arg2) > entry.stamp
+            || killStamp(entry.holder) > entry.stamp) return kNoSymbol;
+        return entry.holder;
+    }
+    
+    size_t size() const { return entries.size(); }
+};
+
+// Counters an optimizer accumulates over every block it has built.
+struct OptimizerStats {
+    size_t cseHits = 0;
+    size_t scopedHits = 0;
+    size_t constantsFolded = 0;
+    size_t simplified = 0;
+    size_t nodes = 0;
+    size_t aliases = 0;
+    double peakLoad = 0;
+    size_t peakBytes = 0;
+    
+    OptimizerStats& operator+=(const OptimizerStats& other) {
+        cseHits += other.cseHits;
+        scopedHits += other.scopedHits;
+        constantsFolded += other.constantsFolded;
+        simplified += other.simplified;
+        nodes += other.nodes;
+        aliases += other.aliases;
+        peakLoad = std::max(peakLoad, other.peakLoad);
+        peakBytes = std::max(peakBytes, other.peakBytes);
+        return *this;
+    }
+};
+
+class BufferedWriter;
+
+enum class DagFormat {
+    Text,
+    Dot,
+    Json
+};
+
+// Which nodes exportDAG writes: those with ids in [firstNode, lastNode] and, if roots are
+// named, only the ones reachable from the nodes those variables hold.
+struct DagFilter {
+    std::vector<std::string> roots;
+    size_t firstNode = 0;
+    size_t lastNode = SIZE_MAX;
+    
+    bool empty() const { return roots.empty() && firstNode == 0 && lastNode == SIZE_MAX; }
+};
+
+class DAGOptimizer {
+private:
+    SymbolTable* symbols;
+    OptimizerStats totals;
+    NodeStore nodes;
+    ExprTable exprToNode; 
+    ValueScope* scope = nullptr;
+    FoldTarget fold;
+    
+    // Indexed by symbol id and only grown, since one table may span many blocks. Entries a block
+    // sets are listed in mappedVars and mappedConstants, and those lists are all that reset() and
+    // generateQuadruples visit, so a block costs what it touches rather than the table's size.
+    std::vector<int> varToNode; 
+    std::vector<int> varToLink;
+    std::vector<int> constantToNode;
+    std::vector<SymbolId> mappedVars;
+    std::vector<SymbolId> mappedConstants;
+    
+    // generateQuadruples' per-variable scratch, sized with varToNode.
+    std::vector<int> busyUntil;
+    std::vector<uint8_t> varFlags;
+
+    int& mappedNode(SymbolId var) {
+        if (var >= static_cast<int>(varToNode.size())) {
+            size_t size = std::max<size_t>(symbols->size(), var + 1);
+            varToNode.resize(size, -1);
+            varToLink.resize(size, -1);
+            busyUntil.resize(size, -1);
+            varFlags.resize(size, 0);
+        }
+        return varToNode[var];
+    }
+    
+    int& constantNode(SymbolId constant) {
+        if (constant >= static_cast<int>(constantToNode.size())) {
+            constantToNode.resize(std::max<size_t>(symbols->size(), constant + 1), -1);
+        }
+        return constantToNode[constant];
+    }
+    
+    // Operands of commutative operators and orderings are looked up lowest node first, so A*B
+    // and B*A (or A<B and B>A) share a node; the node keeps the operand order it was first seen in.
+    int findOrRegisterExpr(Opcode op, int left, int right) {
+        Opcode keyOp = op;
+        int keyLeft = left;
+        int keyRight = right;
+        if (right != -1 && left > right && swappedOpcode(op) != Opcode::None) {
+            keyOp = swappedOpcode(op);
+            std::swap(keyLeft, keyRight);
+        }
+        
+        if (scope && exprToNode.find(keyOp, keyLeft, keyRight) == -1) {
+            int available = availableValue(op, left, right);
+            if (available != -1) {
+                exprToNode.findOrInsert(keyOp, keyLeft, keyRight, available);
+                ++totals.scopedHits;
+                return available;
+            }
+        }
+        
+        int nodeId = exprToNode.findOrInsert(keyOp, keyLeft, keyRight, nodes.size());
+        if (nodeId == static_cast<int>(nodes.size())) {
+            nodes.add(op, left, right);
+        } else {
+            ++totals.cseHits;
+        }
+        return nodeId;
+    }
+    
+    // When both operands are values on entry to the block and a dominating block left
+    // op(left, right) in a variable that still holds it here, that variable's entry value.
+    int availableValue(Opcode op, int left, int right) {
+        auto entrySymbol = [&](int nodeId, SymbolId& symbol) {
+            symbol = nodeId == -1 ? kNoSymbol : nodes.value[nodeId];
+            return nodeId == -1 || symbol != kNoSymbol;
+        };
+        SymbolId arg1, arg2;
+        if (!entrySymbol(left, arg1) || !entrySymbol(right, arg2)) return -1;
+        
+        SymbolId holder = scope->find(op, arg1, arg2);
+        if (holder == kNoSymbol) return -1;
+        int current = mappedNode(holder);
+        if (current != -1 && nodes.value[current] != holder) return -1;
+        return getNodeForValue(holder);
+    }
+    
+    // A literal of the target: one that does not fit its width is never treated as a value.
+    bool immediateOf(int nodeId, int64_t& value) const {
+        if (nodeId == -1 || !symbols->hasImmediate(nodes.value[nodeId])) return false;
+        value = symbols->immediate(nodes.value[nodeId]);
+        return fold.fits(value);
+    }
+    
+    int constantLeaf(int64_t value) {
+        return getNodeForValue(symbols->internConstant(value));
+    }
+    
+    // A literal, or a variable whose current value is one.
+    bool immediateOfValue(SymbolId value, int64_t& immediate) {
+        if (value == kNoSymbol) return false;
+        if (symbols->hasImmediate(value)) {
+            immediate = symbols->immediate(value);
+            return fold.fits(immediate);
+        }
+        return !symbols->isConstant(value) && immediateOf(mappedNode(value), immediate);
+    }
+    
+    bool evaluateConstant(Opcode op, SymbolId arg1, SymbolId arg2, SymbolId& result) {
+        FoldFunction apply = foldFunction(op);
+        int64_t a = 0, b = 0, res = 0;
+        if (!apply || !immediateOfValue(arg1, a)) return false;
+        if (arg2 != kNoSymbol && !immediateOfValue(arg2, b)) return false;
+        if (!apply(a, b, res, fold)) return false;
+        
+        result = symbols->internConstant(res);
+        ++totals.constantsFolded;
+        return true;
+    }
+    
+    // Applies the identity tables and turns multiplication by a power of two into an add or a
+    // shift. Returns -1 when nothing matches.
+    int simplify(Opcode op, int left, int right);
+    
+    int getNodeForValue(SymbolId value) {
+        if (value == kNoSymbol) return -1;
+        
+        bool isConst = symbols->isConstant(value);
+        if (isConst ? constantNode(value) != -1 : mappedNode(value) != -1)
+            return isConst ? constantToNode[value] : varToNode[value];
+        
+        int id = nodes.add(Opcode::None);
+        nodes.value[id] = value;
+        
+        if (isConst) {
+            constantNode(value) = id;
+            mappedConstants.push_back(value);
+        } else {
+            mappedNode(value) = id;
+            mappedVars.push_back(value);
+            varToLink[value] = nodes.addAlias(id, value);
+        }
+        
+        return id;
+    }
+
+    // A variable is an alias of exactly the node holding its current value: rebinding unlinks
+    // it from the previous one, so alias lists never hold stale names. The first name bound to a
+    // node is remembered as its home, to reuse once every alias has moved on.
+    void bind(SymbolId var, int nodeId) {
+        getNode(nodeId);
+        int& mapped = mappedNode(var);
+        if (mapped == nodeId) return;
+        if (mapped != -1) nodes.removeAlias(mapped, varToLink[var]);
+        else mappedVars.push_back(var);
+        mapped = nodeId;
+        varToLink[var] = nodes.addAlias(nodeId, var);
+        if (nodes.home[nodeId] == kNoSymbol) nodes.home[nodeId] = var;
+    }
+    
+public:
+    explicit DAGOptimizer(SymbolTable& table) : symbols(&table) {}
+
+    // With a scope, expressions the scope holds are reused instead of recomputed, buildDAG
+    // kills every variable the block writes and generateQuadruples adds the values the block
+    // leaves in variables. The symbol table must then span every block the scope does.
+    void setScope(ValueScope* valueScope) { scope = valueScope; }
+    
+    // Compact mode keeps aliases as packed varints instead of linked lists (see NodeStore), for
+    // blocks too large for 12 bytes per binding plus 8 per node. Set it before the first block.
+    void setCompact(bool compact) { nodes.compact = compact; }
+    
+    void setFoldTarget(FoldTarget target) { fold = target; }
+    
+    // Bytes allocated for the DAG, the expression table and the per-variable maps.
+    size_t memoryBytes() const {
+        return nodes.memoryBytes() + exprToNode.memoryBytes()
+             + (varToNode.capacity() + varToLink.capacity() + constantToNode.capacity() + busyUntil.capacity()
+                + mappedVars.capacity() + mappedConstants.capacity()) * sizeof(int)
+             + varFlags.capacity();
+    }
+
+    // Forgets the current block but keeps every allocation, so the next block (which may use
+    // a cleared symbol table) starts without touching the heap. Only the map entries the block
+    // set are cleared: the maps keep the size of the largest symbol table seen.
+    void reset() {
+        totals.nodes += nodes.size();
+        totals.aliases += nodes.bindingCount();
+        totals.peakBytes = std::max(totals.peakBytes, memoryBytes());
+        nodes.clear();
+        for (SymbolId var : mappedVars) varToNode[var] = -1;
+        for (SymbolId constant : mappedConstants) constantToNode[constant] = -1;
+        mappedVars.clear();
+        mappedConstants.clear();
+        exprToNode.clear();
+    }
+    
+    // Starts over on another symbol table as if newly constructed (no scope, no compact mode,
+    // no totals), but keeps every allocation, so one optimizer can serve a whole run.
+    void reset(SymbolTable& table) {
+        reset();
+        symbols = &table;
+        scope = nullptr;
+        fold = FoldTarget();
+        nodes.compact = false;
+        totals = OptimizerStats();
+        exprToNode.resetPeak();
+    }
+    
+    // Capacity for a block of about expectedQuads quadruples, so building it does not regrow
+    // the DAG or rehash the expression table. Allocations are only ever grown.
+    void reserve(size_t expectedQuads) {
+        nodes.reserve(expectedQuads, expectedQuads);
+        exprToNode.reserve(expectedQuads);
+        varToNode.reserve(expectedQuads);
+        varToLink.reserve(expectedQuads);
+    }
+
+    DAGNode getNode(int id) const {
+        if (id < 0 || id >= static_cast<int>(nodes.size())) {
+            throw std::out_of_range("Node index out of range: " + std::to_string(id));
+        }
+        return DAGNode(nodes, id);
+    }
+
+    size_t nodeCount() const { return nodes.size(); }
+    
+    // Totals over every block since construction, the current one included. Aliases count
+    // every binding, including ones later overwritten.
+    OptimizerStats stats() const {
+        OptimizerStats current = totals;
+        current.nodes += nodes.size();
+        current.aliases += nodes.bindingCount();
+        current.peakBytes = std::max(current.peakBytes, memoryBytes());
+        current.peakLoad = exprToNode.peakLoad();
+        return current;
+    }
+
+    void buildDAG(const std::vector<Quadruple>& quads) {
+        buildDAG(quads.data(), quads.data() + quads.size());
+    }
+
+    void buildDAG(const Quadruple* first, const Quadruple* last);
+    
+    // Without a live-out set every variable is a root and every alias is written back. With one,
+    // only live variables are roots and only their aliases are kept; readAfter names symbols
+    // that are read after the block (jump operands, or reads in later blocks) and are live
+    // regardless.
+    std::vector<Quadruple> generateQuadruples(const LiveOutSet* liveOut = nullptr,
+                                              const std::vector<SymbolId>& readAfter = {});
+
+    // Writes the block's nodes in id order and its variables in symbol order, so dumps of the
+    // same input diff cleanly. JSON is one object per call, on one line.
+    void exportDAG(BufferedWriter& out, DagFormat format = DagFormat::Text, const DagFilter& filter = {});
+    
+    // The text export of every node, to standard output.
+    void printDAG();
+};
+
+std::string_view trimField(std::string_view field);
+
+// The largest N for which text uses _tN as an operand or result, or 0. A table holding only part
+// of text reserves temporaries up to it so the names it makes up are new to the whole input.
+size_t highestTemporary(std::string_view text);
+
+// text as a quoted JSON string.
+std::string jsonString(std::string_view text);
+
+// Splits "(op, arg1, arg2, result)" into its trimmed fields; false if the line is not a quadruple.
+bool splitQuadrupleLine(std::string_view line, std::string_view (&parts)[4]);
+bool parseQuadrupleLine(std::string_view line, SymbolTable& symbols, Quadruple& quad);
+
+// Takes the next line (without its newline) off the front of buffer.
+bool nextLine(std::string_view& buffer, std::string_view& line);
+
+// Classifies 64 bytes starting at data: bit i is set when data[i] is '\n', '(', ')' or ','.
+// Only the first length bytes are read (length <= 64). Uses AVX2 or NEON when the CPU has it.
+uint64_t classifyDelimiters(const char* data, size_t length);
+
+// Splits a text buffer into quadruples the way nextLine and splitQuadrupleLine would, but finds
+// the delimiters of 64 bytes at a time with classifyDelimiters instead of searching each line.
+class QuadScanner {
+private:
+    const char* data;
+    size_t size;
+    size_t lineStart = 0;
+    size_t chunk = 0;
+    uint64_t mask = 0;
+    
+    size_t nextDelimiter() {
+        while (mask == 0) {
+            chunk += 64;
+            if (chunk >= size) return size;
+            mask = classifyDelimiters(data + chunk, std::min<size_t>(64, size - chunk));
+        }
+        size_t position = chunk + __builtin_ctzll(mask);
+        mask &= mask - 1;
+        return position;
+    }
+    
+public:
+    explicit QuadScanner(std::string_view buffer) : data(buffer.data()), size(buffer.size()) {
+        if (size) mask = classifyDelimiters(data, std::min<size_t>(64, size));
+    }
+    
+    // Takes lines off the buffer until one is a quadruple; false once the buffer is exhausted.
+    bool next(std::string_view (&parts)[4]);
+    
+    bool next(SymbolTable& symbols, Quadruple& quad) {
+        std::string_view parts[4];
+        if (!next(parts)) return false;
+        quad = {symbols.internOpcode(parts[0]), symbols.intern(parts[1]), symbols.intern(parts[2]), symbols.intern(parts[3])};
+        return true;
+    }
+    
+    // The part of the buffer after the last line taken.
+    std::string_view remaining() const { return std::string_view(data + lineStart, size - lineStart); }
+};
+
+void parseQuadruples(std::string_view buffer, SymbolTable& symbols, std::vector<Quadruple>& quads);
+std::vector<Quadruple> parseQuadruples(const std::vector<std::string>& lines, SymbolTable& symbols);
+
+enum class QuadFormat {
+    Text,
+    Binary
+};
+
+// Binary files are a sequence of self-contained segments: a header, a string table holding the
+// segment's opcode names and then its symbol names (each a uint32 length and the bytes), zero
+// padding to a 4-byte boundary and fixed-width records that index those tables. All fields
+// are little-endian; kBinaryNoSymbol marks a blank field.
+const char kBinaryQuadMagic[4] = {'D', 'A', 'G', 'Q'};
+const uint32_t kBinaryQuadVersion = 1;
+const uint32_t kBinaryNoSymbol = 0xFFFFFFFF;
+
+struct BinaryQuadHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t opcodeCount;
+    uint32_t symbolCount;
+    uint64_t quadCount;
+    uint64_t stringBytes;
+};
+
+struct BinaryQuadRecord {
+    uint32_t op;
+    uint32_t arg1;
+    uint32_t arg2;
+    uint32_t result;
+};
+
+static_assert(sizeof(BinaryQuadHeader) == 32, "BinaryQuadHeader layout is part of the file format");
+static_assert(sizeof(BinaryQuadRecord) == 16, "BinaryQuadRecord layout is part of the file format");
+// Headers and records are copied to and from memory as they are, in the host's byte order.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the binary quadruple format needs a little-endian host");
+
+inline bool isBinaryQuadFile(std::string_view contents) {
+    return contents.size() >= sizeof(kBinaryQuadMagic)
+        && std::memcmp(contents.data(), kBinaryQuadMagic, sizeof(kBinaryQuadMagic)) == 0;
+}
+
+// Collects output in one reusable buffer and hands it to write(2) in large blocks.
+class BufferedWriter {
+private:
+    static const size_t kBufferSize = 1 << 20;
+    
+    int fd = -1;
+    std::string* sink = nullptr;
+    bool ownsFd = false;
+    bool failed = false;
+    std::vector<char> buffer;
+    size_t used = 0;
+    
+    void writeAll(const char* data, size_t size) {
+        if (sink) {
+            sink->append(data, size);
+            return;
+        }
+        while (size > 0 && !failed) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                failed = true;
+                return;
+            }
+            data += written;
+            size -= written;
+        }
+    }
+    
+public:
+    explicit BufferedWriter(const std::string& filePath)
+        : fd(::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)), ownsFd(true), buffer(kBufferSize) {}
+    
+    explicit BufferedWriter(int descriptor) : fd(descriptor), buffer(kBufferSize) {}
+    
+    // Appends to *output instead of a file; nothing is written until flush() or close().
+    explicit BufferedWriter(std::string* output) : sink(output), buffer(kBufferSize) {}
+    
+    ~BufferedWriter() { close(); }
+    
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+    
+    bool isOpen() const { return fd != -1 || sink; }
+    
+    void append(std::string_view text) {
+        if (used + text.size() > buffer.size()) {
+            flush();
+            if (text.size() > buffer.size()) {
+                writeAll(text.data(), text.size());
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+    
+    void append(int64_t value) {
+        char digits[24];
+        auto formatted = std::to_chars(digits, digits + sizeof(digits), value);
+        append(std::string_view(digits, formatted.ptr - digits));
+    }
+    
+    // Returns false if any write so far has failed.
+    bool flush() {
+        if (isOpen() && used > 0) writeAll(buffer.data(), used);
+        used = 0;
+        return !failed;
+    }
+    
+    bool close() {
+        bool ok = flush();
+        if (ownsFd && fd != -1) {
+            ok = ::close(fd) == 0 && ok;
+        }
+        fd = -1;
+        sink = nullptr;
+        return ok;
+    }
+};
+
+// Formats quadruples through a BufferedWriter. In binary mode records are collected until
+// endSegment(), which must be called before the symbol table they refer to changes; close()
+// ends the last segment.
+class QuadWriter : public BufferedWriter {
+private:
+    QuadFormat format = QuadFormat::Text;
+    
+    const SymbolTable* segmentTable = nullptr;
+    std::vector<BinaryQuadRecord> records;
+    std::vector<uint32_t> symbolSlots;
+    std::vector<SymbolId> segmentSymbols;
+    std::vector<uint32_t> opcodeSlots;
+    std::vector<Opcode> segmentOpcodes;
+    
+    static uint32_t localIndex(size_t key, std::vector<uint32_t>& slots, size_t& next) {
+        if (key >= slots.size()) slots.resize(key + 1, 0);
+        if (slots[key] == 0) slots[key] = ++next;
+        return slots[key] - 1;
+    }
+    
+    uint32_t localSymbol(SymbolId id) {
+        if (id == kNoSymbol) return kBinaryNoSymbol;
+        size_t next = segmentSymbols.size();
+        uint32_t index = localIndex(id, symbolSlots, next);
+        if (next != segmentSymbols.size()) segmentSymbols.push_back(id);
+        return index;
+    }
+    
+    uint32_t localOpcode(Opcode op) {
+        size_t next = segmentOpcodes.size();
+        uint32_t index = localIndex(static_cast<size_t>(op), opcodeSlots, next);
+        if (next != segmentOpcodes.size()) segmentOpcodes.push_back(op);
+        return index;
+    }
+    
+    void appendString(const std::string& text) {
+        uint32_t length = text.size();
+        append(std::string_view(reinterpret_cast<const char*>(&length), sizeof(length)));
+        append(text);
+    }
+    
+public:
+    explicit QuadWriter(const std::string& filePath, QuadFormat outputFormat = QuadFormat::Text)
+        : BufferedWriter(filePath), format(outputFormat) {}
+    
+    explicit QuadWriter(int descriptor, QuadFormat outputFormat = QuadFormat::Text)
+        : BufferedWriter(descriptor), format(outputFormat) {}
+    
+    explicit QuadWriter(std::string* output, QuadFormat outputFormat = QuadFormat::Text)
+        : BufferedWriter(output), format(outputFormat) {}
+    
+    ~QuadWriter() { close(); }
+    
+    void write(const Quadruple& quad, const SymbolTable& symbols) {
+        if (format == QuadFormat::Binary) {
+            segmentTable = &symbols;
+            records.push_back({localOpcode(quad.op), localSymbol(quad.arg1), localSymbol(quad.arg2),
+                               localSymbol(quad.result)});
+            return;
+        }
+        
+        append("(");
+        append(symbols.opcodeName(quad.op));
+        append(", ");
+        append(symbols.name(quad.arg1));
+        append(", ");
+        append(symbols.name(quad.arg2));
+        append(", ");
+        append(symbols.name(quad.result));
+        append(")\n");
+    }
+    
+    void write(const std::vector<Quadruple>& quads, const SymbolTable& symbols) {
+        for (const auto& quad : quads) {
+            write(quad, symbols);
+        }
+    }
+    
+    void endSegment();
+    
+    bool close() {
+        if (isOpen()) endSegment();
+        return BufferedWriter::close();
+    }
+};
+
+// Loads every segment of a binary file. Names are interned once per segment and records map
+// straight to quadruples through the segment's index tables.
+void loadBinaryQuadruples(std::string_view contents, SymbolTable& symbols, std::vector<Quadruple>& quads);
+
+void printQuadruples(const std::vector<Quadruple>& quads, const SymbolTable& symbols);
+
+// Calls fn(first, last, control) for each basic block of [first, end). A block ends at a quad
+// endsBlock accepts, passed as control, or after blockSize quads when blockSize is set (control
+// is nullptr).
+template <typename Fn>
+void forEachBlock(const Quadruple* first, const Quadruple* end, size_t blockSize, Fn fn) {
+    const Quadruple* blockStart = first;
+    for (const Quadruple* it = first; it != end; ++it) {
+        if (endsBlock(*it)) {
+            fn(blockStart, it, it);
+            blockStart = it + 1;
+        } else if (blockSize != 0 && static_cast<size_t>(it - blockStart) == blockSize) {
+            fn(blockStart, it, nullptr);
+            blockStart = it;
+        }
+    }
+    fn(blockStart, end, nullptr);
+}
+
+struct BlockRange {
+    const Quadruple* first;
+    const Quadruple* last;
+    const Quadruple* control;
+};
+
+// The blocks forEachBlock cuts a program into, as a control-flow graph with its dominator tree.
+// A jump leads to the block after its label, and every block but one ending in an unconditional
+// jump falls through to the next. Blocks unreachable from the first have no dominator.
+class BlockGraph {
+private:
+    std::vector<std::vector<int>> predecessors;
+    std::vector<int> visited;
+    int visitMark = 0;
+    
+    void computeDominators(const std::vector<std::vector<int>>& successors);
+    
+public:
+    std::vector<BlockRange> blocks;
+    std::vector<int> idom;
+    std::vector<std::vector<int>> children;
+    
+    BlockGraph(const Quadruple* first, const Quadruple* end, size_t blockSize);
+    
+    // The variables written by every block on a path from the end of block's immediate dominator
+    // to the start of block, which are exactly the ones that may change in between.
+    void entryKills(int block, std::vector<SymbolId>& kills);
+    
+    // For each block, the variables some block after it may read before writing them, found by
+    // backward liveness over the graph, in symbol order. Each variable is traced back from its
+    // reads only as far as it is live, so the work follows the size of the live sets rather than
+    // blocks times variables.
+    std::vector<std::vector<SymbolId>> liveAfter(const SymbolTable& symbols) const;
+};
+
+// Calls fn(block) for each block of graph in a preorder walk of its dominator tree, with scope
+// holding the expressions available on entry to the block. Blocks without a dominator (the
+// first one and unreachable ones) start from an empty scope.
+template <typename Fn>
+void forEachBlockInDominatorOrder(BlockGraph& graph, ValueScope& scope, Fn fn) {
+    std::vector<SymbolId> kills;
+    auto enter = [&](int block) {
+        scope.enter();
+        graph.entryKills(block, kills);
+        for (SymbolId var : kills) scope.kill(var);
+        fn(block);
+    };
+    
+    std::vector<std::pair<int, size_t>> path;
+    for (int root = 0; root < static_cast<int>(graph.blocks.size()); ++root) {
+        if (graph.idom[root] != -1) continue;
+        enter(root);
+        path.push_back({root, 0});
+        while (!path.empty()) {
+            int block = path.back().first;
+            size_t next = path.back().second++;
+            if (next < graph.children[block].size()) {
+                int child = graph.children[block][next];
+                enter(child);
+                path.push_back({child, 0});
+            } else {
+                scope.leave();
+                path.pop_back();
+            }
+        }
+    }
+}
+
+// What optimizeBlock and optimizeBlocks call around each block. Each call does nothing here; a
+// caller derives from this and hides the ones it needs.
+struct BlockHooks {
+    void begin() {}                                 // before the block's DAG is built
+    void built(DAGOptimizer&) {}                    // once it is built
+    void emitted() {}                               // once its quadruples are generated
+    void output(const std::vector<Quadruple>&) {}   // its result, control quad last, in program order
+};
+
+// Optimizes [first, last) with optimizer and returns it, followed by the control quad that ends
+// the block. liveAfter adds the variables later blocks may read to the ones the block keeps.
+template <typename Hooks = BlockHooks>
+std::vector<Quadruple> optimizeBlock(DAGOptimizer& optimizer, const Quadruple* first, const Quadruple* last,
+                                     const Quadruple* control, const LiveOutSet* liveOut = nullptr,
+                                     const std::vector<SymbolId>* liveAfter = nullptr, Hooks&& hooks = Hooks()) {
+    std::vector<Quadruple> result;
+    if (first != last) {
+        hooks.begin();
+        optimizer.reset();
+        optimizer.buildDAG(first, last);
+        hooks.built(optimizer);
+        
+        std::vector<SymbolId> readAfter;
+        if (control) readAfter = {control->arg1, control->arg2};
+        if (liveAfter) readAfter.insert(readAfter.end(), liveAfter->begin(), liveAfter->end());
+        
+        result = optimizer.generateQuadruples(liveOut, readAfter);
+        hooks.emitted();
+    }
+    
+    if (control) result.push_back(*control);
+    return result;
+}
+
+// Optimizes [quads, quads + count), parsed into symbols, block by block with optimizer and passes
+// each block's result to hooks.output. With acrossBlocks the blocks are optimized in
+// dominator-tree order, reusing values their dominators left in variables (see ValueScope), and
+// output in program order once all are done. liveOut holds at the end of the program; each block
+// also keeps what later blocks may read (see BlockGraph::liveAfter).
+template <typename Hooks = BlockHooks>
+void optimizeBlocks(DAGOptimizer& optimizer, const Quadruple* quads, size_t count, SymbolTable& symbols,
+                    const LiveOutSet* liveOut, size_t blockSize, bool acrossBlocks, Hooks&& hooks = Hooks()) {
+    if (!acrossBlocks && !liveOut) {
+        forEachBlock(quads, quads + count, blockSize,
+                [&](const Quadruple* first, const Quadruple* last, const Quadruple* control) {
+            hooks.output(optimizeBlock(optimizer, first, last, control, liveOut, nullptr, hooks));
+        });
+        return;
+    }
+    
+    BlockGraph graph(quads, quads + count, blockSize);
+    std::vector<std::vector<SymbolId>> liveAfter;
+    if (liveOut) liveAfter = graph.liveAfter(symbols);
+    std::vector<std::vector<Quadruple>> results(graph.blocks.size());
+    auto run = [&](int block) {
+        const BlockRange& range = graph.blocks[block];
+        results[block] = optimizeBlock(optimizer, range.first, range.last, range.control, liveOut,
+                                       liveOut ? &liveAfter[block] : nullptr, hooks);
+    };
+    if (acrossBlocks) {
+        ValueScope scope;
+        optimizer.setScope(&scope);
+        forEachBlockInDominatorOrder(graph, scope, run);
+        optimizer.setScope(nullptr);
+    } else {
+        for (size_t block = 0; block < graph.blocks.size(); ++block) run(block);
+    }
+    for (const auto& result : results) hooks.output(result);
+}
+
+// Optimizes a program held in memory block by block, exactly as the driver does for a file, and
+// returns the result with control quads in place. Folded constants and temporaries are interned
+// into symbols, which the input must have been parsed with. acrossBlocks also reuses values
+// that dominating blocks left in variables (see ValueScope). liveOut holds at the end of the
+// program: every block also keeps the variables later blocks may read (see
+// BlockGraph::liveAfter), so only values nothing reads are dropped. Constants fold in the
+// integers of fold.
+std::vector<Quadruple> optimize(const Quadruple* quads, size_t count, SymbolTable& symbols,
+                                const LiveOutSet* liveOut = nullptr, size_t blockSize = 0,
+                                bool acrossBlocks = false, FoldTarget fold = {});
+
+inline std::vector<Quadruple> optimize(const std::vector<Quadruple>& quads, SymbolTable& symbols,
+                                       const LiveOutSet* liveOut = nullptr, size_t blockSize = 0,
+                                       bool acrossBlocks = false, FoldTarget fold = {}) {
+    return optimize(quads.data(), quads.size(), symbols, liveOut, blockSize, acrossBlocks, fold);
+}
+
+// Copy propagation across blocks: after (=, Y, , X), a read of X that the copy dominates reads Y
+// (or the constant) instead, as long as neither X nor Y is written in between, the same rule
+// ValueScope applies to expressions. Only copies into variables outside liveOut are propagated,
+// as the others stay anyway; once nothing reads such a copy, optimizing with liveOut drops it.
+// Returns the number of operands rewritten.
+size_t propagateCopies(Quadruple* quads, size_t count, const SymbolTable& symbols, const LiveOutSet& liveOut,
+                       size_t blockSize = 0);
+
+#endif
@@ -1,387 +1,1846 @@
+#include "dagopt.h"
+
 #include <iostream>
-#include <vector>
-#include <string>
-#include <unordered_map>
-#include <map>
-#include <set>
-#include <algorithm>
+#include <cctype>
 #include <functional>
-#include <fstream>
 #include <sstream>
+#include <fstream>
+#include <exception>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <optional>
+#include <filesystem>
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <sys/resource.h>
 
-struct Quadruple {
-    std::string op;
-    std::string arg1;
-    std::string arg2;
-    std::string result;
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+    size_t released = 0;
+
+public:
+    explicit MappedFile(const std::string& filePath) {
+        int fd = open(filePath.c_str(), O_RDONLY);
+        if (fd == -1) return;
+        
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(mapped);
+                length = info.st_size;
+            }
+        }
+        close(fd);
+    }
+    
+    ~MappedFile() {
+        if (data) munmap(const_cast<char*>(data), length);
+    }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
     
-    Quadruple(std::string o = "", std::string a1 = "", std::string a2 = "", std::string r = "")
-        : op(o), arg1(a1), arg2(a2), result(r) {}
+    std::string_view contents() const { return std::string_view(data, length); }
+    
+    // Faults every page in, so the file is read on the calling thread rather than by whoever
+    // parses it later.
+    void prefetch() {
+        if (!data) return;
+        madvise(const_cast<char*>(data), length, MADV_WILLNEED);
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        volatile char sink = 0;
+        for (size_t offset = 0; offset < length; offset += pageSize) sink = data[offset];
+        (void)sink;
+    }
+    
+    // Drops the pages before offset so a streaming reader only keeps its window resident.
+    void release(size_t offset) {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t end = std::min(offset, length) / pageSize * pageSize;
+        if (end > released) {
+            madvise(const_cast<char*>(data) + released, end - released, MADV_DONTNEED);
+            released = end;
+        }
+    }
+    
+    // Drops the whole pages in [offset, offset + size) without moving the release mark, for data
+    // that was read ahead of the stream.
+    void evict(size_t offset, size_t size) {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t first = std::max(released, offset / pageSize * pageSize);
+        size_t end = std::min(offset + size, length) / pageSize * pageSize;
+        if (data && end > first) madvise(const_cast<char*>(data) + first, end - first, MADV_DONTNEED);
+    }
 };
 
-class DAGNode {
-public:
-    int id;
-    std::string op;  
-    int left;         
-    int right;          
-    std::vector<std::string> aliases; 
+bool matchesAnyGlob(const std::vector<std::string>& globs, const std::string& name) {
+    if (globs.empty()) return true;
+    return std::any_of(globs.begin(), globs.end(),
+            [&name](const std::string& glob) { return globMatch(glob, name); });
+}
+
+// Lists regular files in sorted order, skipping hidden entries. Globs are matched against
+// the file name; an empty list accepts every file.
+std::vector<std::string> listFilesInDirectory(const std::string& directoryPath, bool recursive = false,
+                                              const std::vector<std::string>& globs = {}) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+    std::error_code ec;
+    
+    auto consider = [&](const fs::directory_entry& entry) {
+        std::string name = entry.path().filename().string();
+        std::error_code typeError;
+        if (entry.is_regular_file(typeError) && matchesAnyGlob(globs, name)) {
+            files.push_back(entry.path().string());
+        }
+    };
+    
+    if (recursive) {
+        fs::recursive_directory_iterator it(directoryPath, fs::directory_options::skip_permission_denied, ec);
+        for (fs::recursive_directory_iterator end; !ec && it != end; it.increment(ec)) {
+            if (it->path().filename().string()[0] == '.') {
+                it.disable_recursion_pending();
+                continue;
+            }
+            consider(*it);
+        }
+    } else {
+        fs::directory_iterator it(directoryPath, ec);
+        for (fs::directory_iterator end; !ec && it != end; it.increment(ec)) {
+            if (it->path().filename().string()[0] == '.') continue;
+            consider(*it);
+        }
+    }
+    
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void ensureDirectoryExists(const std::string& dir) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+}
+
+// XXH64 of data; fast enough that hashing an input costs about as much as reading it.
+uint64_t hashContents(std::string_view data, uint64_t seed = 0) {
+    const uint64_t p1 = 11400714785074694791ULL, p2 = 14029467366897019727ULL, p3 = 1609587929392839161ULL;
+    const uint64_t p4 = 9650029242287828579ULL, p5 = 2870177450012600261ULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * p2, 31) * p1; };
+    auto read64 = [](const char* p) { uint64_t v; std::memcpy(&v, p, sizeof(v)); return v; };
+    auto read32 = [](const char* p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; };
+    
+    const char* p = data.data();
+    const char* end = p + data.size();
+    uint64_t h;
+    if (data.size() >= 32) {
+        uint64_t v[4] = {seed + p1 + p2, seed + p2, seed, seed - p1};
+        for (; p + 32 <= end; p += 32) {
+            for (int i = 0; i < 4; ++i) v[i] = round(v[i], read64(p + 8 * i));
+        }
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int i = 0; i < 4; ++i) h = (h ^ round(0, v[i])) * p1 + p4;
+    } else {
+        h = seed + p5;
+    }
+    
+    h += data.size();
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * p1 + p4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * p1), 23) * p2 + p3;
+        p += 4;
+    }
+    for (; p < end; ++p) h = rotl(h ^ (static_cast<unsigned char>(*p) * p5), 11) * p1;
+    
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+struct BenchmarkOptions {
+    std::vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+    double cseRatio = 0.2;
+    double constDensity = 0.1;
+    double aliasFanout = 0.5;
+    uint64_t seed = 1;
+};
+
+struct CheckOptions {
+    std::string goldenDir;
+    std::string baseline;
+    bool updateBaseline = false;
+    double maxSlowdown = 0.25;
+};
+
+struct DriverOptions {
+    std::string inputDir = "test";
+    std::string outputDir = "test_out";
+    bool streaming = false;
+    bool pipeline = false;
+    bool acrossBlocks = false;
+    bool compact = false;
+    FoldTarget fold;
+    size_t blockSize = 0;
+    size_t jobs = 1;
+    size_t blockJobs = 1;
+    bool recursive = false;
+    std::vector<std::string> globs;
+    bool eliminateDeadCode = false;
+    bool coalesce = false;
+    LiveOutSet liveOut;
+    bool benchmark = false;
+    BenchmarkOptions bench;
+    bool check = false;
+    CheckOptions checks;
+    QuadFormat outputFormat = QuadFormat::Text;
+    bool printStats = false;
+    std::string statsJson;
+    std::string cacheDir;
+    bool dumpDag = false;
+    DagFormat dagFormat = DagFormat::Text;
+    DagFilter dagFilter;
     
-    DAGNode(int i, std::string o, int l = -1, int r = -1)
-        : id(i), op(o), left(l), right(r) {}
+    const LiveOutSet* liveOutSet() const { return eliminateDeadCode ? &liveOut : nullptr; }
+};
+
+// Wall time per phase and counters for one input. In parallel block mode parse, build and emit
+// are summed over the workers.
+struct RunStats {
+    double readMs = 0;
+    double parseMs = 0;
+    double buildMs = 0;
+    double emitMs = 0;
+    double writeMs = 0;
+    size_t quadsIn = 0;
+    size_t quadsOut = 0;
+    size_t cacheHits = 0;
+    OptimizerStats optimizer;
     
-    bool isLeaf() const { return left == -1 && right == -1; }
+    RunStats& operator+=(const RunStats& other) {
+        readMs += other.readMs;
+        parseMs += other.parseMs;
+        buildMs += other.buildMs;
+        emitMs += other.emitMs;
+        writeMs += other.writeMs;
+        quadsIn += other.quadsIn;
+        quadsOut += other.quadsOut;
+        cacheHits += other.cacheHits;
+        optimizer += other.optimizer;
+        return *this;
+    }
 };
 
-class DAGOptimizer {
+// Milliseconds between successive laps.
+class PhaseClock {
 private:
-    std::vector<DAGNode> nodes;
-    std::unordered_map<std::string, int> varToNode; 
-    std::unordered_map<std::string, int> exprToNode; 
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point last = Clock::now();
+
+public:
+    double lap() {
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+        return elapsed;
+    }
+};
+
+void printStats(std::ostream& out, const RunStats& stats) {
+    const OptimizerStats& opt = stats.optimizer;
+    out << std::fixed << std::setprecision(2)
+        << "  time ms: read " << stats.readMs << ", parse " << stats.parseMs << ", build " << stats.buildMs
+        << ", emit " << stats.emitMs << ", write " << stats.writeMs << std::endl
+        << "  quads " << stats.quadsIn << " -> " << stats.quadsOut << ", cache hits " << stats.cacheHits
+        << ", cse hits " << opt.cseHits << ", cross-block hits " << opt.scopedHits
+        << ", folded " << opt.constantsFolded << ", simplified " << opt.simplified << ", nodes " << opt.nodes
+        << ", aliases " << opt.aliases << ", peak load " << opt.peakLoad << ", peak DAG bytes " << opt.peakBytes
+        << std::endl;
+    out << std::defaultfloat;
+}
+
+void writeStatsJson(std::ostream& out, const RunStats& stats) {
+    const OptimizerStats& opt = stats.optimizer;
+    out << std::fixed << std::setprecision(3)
+        << "{\"read_ms\": " << stats.readMs << ", \"parse_ms\": " << stats.parseMs
+        << ", \"build_ms\": " << stats.buildMs << ", \"emit_ms\": " << stats.emitMs
+        << ", \"write_ms\": " << stats.writeMs << ", \"quads_in\": " << stats.quadsIn
+        << ", \"quads_out\": " << stats.quadsOut << ", \"cache_hits\": " << stats.cacheHits
+        << ", \"cse_hits\": " << opt.cseHits << ", \"cross_block_hits\": " << opt.scopedHits
+        << ", \"constants_folded\": " << opt.constantsFolded << ", \"simplified\": " << opt.simplified
+        << ", \"nodes\": " << opt.nodes << ", \"aliases\": " << opt.aliases
+        << ", \"peak_load\": " << opt.peakLoad << ", \"peak_dag_bytes\": " << opt.peakBytes << "}";
+    out << std::defaultfloat;
+}
+
+// {"files": [{"file": ..., "stats": {...}}, ...], "total": {...}}
+bool writeStatsJsonFile(const std::string& path, const std::vector<std::pair<std::string, RunStats>>& files,
+                        const RunStats& total) {
+    std::ofstream out(path);
+    out << "{\"files\": [";
+    for (size_t i = 0; i < files.size(); ++i) {
+        out << (i ? ",\n  " : "\n  ") << "{\"file\": " << jsonString(files[i].first) << ", \"stats\": ";
+        writeStatsJson(out, files[i].second);
+        out << "}";
+    }
+    out << "\n], \"total\": ";
+    writeStatsJson(out, total);
+    out << "}" << std::endl;
+    return static_cast<bool>(out);
+}
+
+// Runs batches of tasks on per-worker deques. A worker pops from the front of its own deque
+// and, once that is empty, steals from the back of the others. The calling thread is worker 0;
+// the others are started once and wait between batches, so a pool can run many small batches.
+class WorkStealingPool {
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    size_t nextQueue = 0;
+    std::vector<std::thread> helpers;
+    std::mutex stateMutex;
+    std::condition_variable batchStarted;
+    std::condition_variable batchDone;
+    size_t batch = 0;
+    size_t busyHelpers = 0;
+    bool stopping = false;
+    
+    bool popLocal(size_t worker, std::function<void()>& task) {
+        WorkQueue& queue = *queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+    }
     
-    int findCommonExpr(const std::string& op, int left, int right) {
-        std::string key = op + "_" + std::to_string(left) + "_" + std::to_string(right);
-        auto it = exprToNode.find(key);
-        return it != exprToNode.end() ? it->second : -1;
+    bool steal(size_t thief, std::function<void()>& task) {
+        for (size_t i = 1; i < queues.size(); ++i) {
+            WorkQueue& queue = *queues[(thief + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+        return false;
     }
     
-    void registerExpr(const std::string& op, int left, int right, int nodeId) {
-        std::string key = op + "_" + std::to_string(left) + "_" + std::to_string(right);
-        exprToNode[key] = nodeId;
+    void work(size_t worker) {
+        std::function<void()> task;
+        while (popLocal(worker, task) || steal(worker, task)) {
+            task();
+        }
     }
     
-    bool evaluateConstant(const std::string& op, const std::string& arg1, const std::string& arg2, std::string& result) {
-        bool isNum1 = !arg1.empty() && std::all_of(arg1.begin(), arg1.end(), 
-                [](char c) { return std::isdigit(c) || c == '-'; });
-        bool isNum2 = arg2.empty() || std::all_of(arg2.begin(), arg2.end(),
-                [](char c) { return std::isdigit(c) || c == '-'; });
-        
-        if (!isNum1 || !isNum2) return false;
-        
-        int val1 = std::stoi(arg1);
-        int val2 = arg2.empty() ? 0 : std::stoi(arg2);
-        int res = 0;
+    void serve(size_t worker) {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                batchStarted.wait(lock, [&]() { return stopping || batch != seen; });
+                if (stopping) return;
+                seen = batch;
+            }
+            work(worker);
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--busyHelpers == 0) batchDone.notify_one();
+        }
+    }
+    
+public:
+    explicit WorkStealingPool(size_t workers) {
+        for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i) {
+            queues.push_back(std::make_unique<WorkQueue>());
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            helpers.emplace_back(&WorkStealingPool::serve, this, i);
+        }
+    }
+    
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        batchStarted.notify_all();
+        for (auto& thread : helpers) {
+            thread.join();
+        }
+    }
+    
+    // Tasks are dealt round-robin, so submitting in priority order keeps each deque sorted.
+    void submit(std::function<void()> task) {
+        queues[nextQueue]->tasks.push_back(std::move(task));
+        nextQueue = (nextQueue + 1) % queues.size();
+    }
+    
+    // Returns once every task submitted since the last run has finished.
+    void run() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            busyHelpers = helpers.size();
+            ++batch;
+        }
+        batchStarted.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(stateMutex);
+        batchDone.wait(lock, [&]() { return busyHelpers == 0; });
+    }
+};
+
+const size_t kDefaultStreamBlockSize = 65536;
+
+// Every thread keeps one symbol table, optimizer and quad buffer for all the files and blocks
+// it handles, so their capacity carries over instead of being allocated again each time.
+struct Workspace {
+    SymbolTable symbols;
+    DAGOptimizer optimizer{symbols};
+    std::vector<Quadruple> quads;
+};
+
+Workspace& threadWorkspace() {
+    thread_local Workspace workspace;
+    return workspace;
+}
+
+// A guess at the number of quadruples in contents, for reserving: binary records take 16
+// bytes and text quadruples seldom fewer.
+size_t expectedQuads(std::string_view contents) {
+    return contents.size() / sizeof(BinaryQuadRecord);
+}
+
+// Slots in the name table shared by the blocks of a file in parallel mode (8 bytes each); names
+// past three quarters of it are kept per block.
+const size_t kMaxSharedSymbols = 1 << 20;
+
+// Part of every cache key; bump it whenever the output for a given input and options changes.
+const uint32_t kOptimizerVersion = 1;
+
+// Everything besides the input that decides the output bytes. Job counts do not: parallel
+// runs write the same output as serial ones.
+uint64_t optionsFingerprint(const DriverOptions& options) {
+    std::vector<std::string> liveOut(options.liveOut.variables.begin(), options.liveOut.variables.end());
+    std::sort(liveOut.begin(), liveOut.end());
+    
+    std::ostringstream key;
+    key << kOptimizerVersion << '|' << static_cast<int>(options.outputFormat) << '|' << options.streaming
+        << '|' << options.blockSize << '|' << options.eliminateDeadCode << '|' << options.liveOut.tempPattern
+        << '|' << options.acrossBlocks << '|' << options.coalesce << '|' << options.fold.bits
+        << '|' << options.fold.wraps;
+    for (const auto& name : liveOut) key << '|' << name;
+    return hashContents(key.str());
+}
+
+// Cache entries are named by a hash of the input seeded with the options fingerprint, plus the
+// input size.
+std::string cacheEntryPath(const DriverOptions& options, std::string_view contents) {
+    char name[40];
+    std::snprintf(name, sizeof(name), "%016llx-%zu",
+                  static_cast<unsigned long long>(hashContents(contents, optionsFingerprint(options))),
+                  contents.size());
+    return (std::filesystem::path(options.cacheDir) / name).string();
+}
+
+// Hard-links from to `to`, falling back to a copy across filesystems.
+bool linkOrCopy(const std::string& from, const std::string& to) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_hard_link(from, to, ec);
+    if (!ec) return true;
+    if (!fs::exists(from, ec)) return false;
+    return fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec) && !ec;
+}
+
+// A name next to path that no other process or thread writes to.
+std::string stagingPathFor(const std::string& path) {
+    return path + "." + std::to_string(::getpid()) + "."
+         + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+// Moves an output finished under staging into place. The rename replaces the old directory
+// entry rather than writing through it, so an old output that is a hard link into the cache
+// leaves the entry as it was.
+bool publishOutput(const std::string& staging, const std::string& outputFile) {
+    if (std::rename(staging.c_str(), outputFile.c_str()) == 0) return true;
+    std::remove(staging.c_str());
+    return false;
+}
+
+// Publishes a finished output under its cache entry. The rename makes the entry appear whole,
+// even with several workers storing the same one.
+void storeInCache(const std::string& outputFile, const std::string& entry) {
+    std::string staging = stagingPathFor(entry);
+    if (!linkOrCopy(outputFile, staging)) return;
+    if (std::rename(staging.c_str(), entry.c_str()) != 0) std::remove(staging.c_str());
+}
+
+// Applies the optimizer settings among options to an optimizer that was just reset.
+void configureOptimizer(DAGOptimizer& optimizer, const DriverOptions& options) {
+    optimizer.setCompact(options.compact);
+    optimizer.setFoldTarget(options.fold);
+}
+
+// --dump-dag: every block's DAG is exported to out once it is built.
+struct DagDump {
+    BufferedWriter out;
+    DagFormat format;
+    const DagFilter& filter;
+    
+    template <typename Target>
+    DagDump(Target target, const DriverOptions& options)
+        : out(target), format(options.dagFormat), filter(options.dagFilter) {}
+};
+
+const char* dagDumpExtension(DagFormat format) {
+    switch (format) {
+        case DagFormat::Dot: return ".dot";
+        case DagFormat::Json: return ".jsonl";
+        default: return ".dag";
+    }
+}
+
+// Times the phases of each block into stats, and exports its DAG to dump once it is built.
+struct StatsHooks : BlockHooks {
+    RunStats& stats;
+    DagDump* dump;
+    PhaseClock clock;
+    
+    explicit StatsHooks(RunStats& stats, DagDump* dump = nullptr) : stats(stats), dump(dump) {}
+    
+    void begin() { clock.lap(); }
+    void built(DAGOptimizer& optimizer) {
+        stats.buildMs += clock.lap();
+        if (dump) {
+            optimizer.exportDAG(dump->out, dump->format, dump->filter);
+            clock.lap();
+        }
+    }
+    void emitted() { stats.emitMs += clock.lap(); }
+};
+
+// optimizeBlocks over a whole program with the thread's optimizer, writing each block to out.
+void optimizeBlocks(const std::vector<Quadruple>& quads, SymbolTable& symbols, size_t blockSize,
+                    bool acrossBlocks, const DriverOptions& options, const LiveOutSet* liveOut,
+                    QuadWriter& out, RunStats& stats, DagDump* dump) {
+    struct WriteHooks : StatsHooks {
+        QuadWriter& out;
+        SymbolTable& symbols;
         
-        if (op == "+") res = val1 + val2;
-        else if (op == "-") res = val1 - val2;
-        else if (op == "*") res = val1 * val2;
-        else if (op == "/") {
-            if (val2 == 0) return false;
-            res = val1 / val2;
-        }
-        else return false;
+        WriteHooks(RunStats& stats, DagDump* dump, QuadWriter& out, SymbolTable& symbols)
+            : StatsHooks(stats, dump), out(out), symbols(symbols) {}
         
-        result = std::to_string(res);
-        return true;
+        void output(const std::vector<Quadruple>& result) {
+            PhaseClock clock;
+            out.write(result, symbols);
+            stats.writeMs += clock.lap();
+            stats.quadsOut += result.size();
+        }
+    } hooks(stats, dump, out, symbols);
+    
+    DAGOptimizer& optimizer = threadWorkspace().optimizer;
+    optimizer.reset(symbols);
+    configureOptimizer(optimizer, options);
+    optimizer.reserve(blockSize != 0 ? std::min(blockSize, quads.size()) : quads.size());
+    optimizeBlocks(optimizer, quads.data(), quads.size(), symbols, liveOut, blockSize, acrossBlocks, hooks);
+    stats.optimizer += optimizer.stats();
+}
+
+// highestTemporary of contents, read a window of whole lines at a time. The windows of a mapped
+// file are evicted again so that a stream over it stays within its memory bound.
+size_t highestTemporaryIn(std::string_view contents, MappedFile* mapped) {
+    const size_t kWindowBytes = 16 << 20;
+    size_t highest = 0;
+    for (size_t start = 0; start < contents.size();) {
+        size_t end = contents.size();
+        if (end - start > kWindowBytes) {
+            size_t newline = contents.rfind('\n', start + kWindowBytes);
+            if (newline != std::string_view::npos && newline >= start) end = newline + 1;
+        }
+        highest = std::max(highest, highestTemporary(contents.substr(start, end - start)));
+        if (mapped) mapped->evict(start, end - start);
+        start = end;
     }
+    return highest;
+}
+
+// Parses and optimizes one block at a time so memory stays bounded by the block size;
+// each block gets a fresh symbol table, whose temporaries are numbered past any _tN of the
+// whole input. Returns the number of quadruples read.
+size_t streamBlocks(std::string_view contents, MappedFile* mapped, size_t blockSize, const DriverOptions& options,
+                    const LiveOutSet* liveOut, QuadWriter& out, RunStats& stats, DagDump* dump) {
+    QuadScanner scanner(contents);
+    Workspace& workspace = threadWorkspace();
+    SymbolTable& symbols = workspace.symbols;
+    const size_t reserved = highestTemporaryIn(contents, mapped);
+    symbols.clear();
+    symbols.reserveTemporaries(reserved);
+    DAGOptimizer& optimizer = workspace.optimizer;
+    optimizer.reset(symbols);
+    configureOptimizer(optimizer, options);
+    size_t expected = std::min(blockSize, expectedQuads(contents));
+    optimizer.reserve(expected);
+    std::vector<Quadruple>& block = workspace.quads;
+    block.clear();
+    block.reserve(expected);
+    size_t count = 0;
+    PhaseClock clock;
     
-    int getNodeForValue(const std::string& value) {
-        if (value.empty()) return -1;
+    auto flush = [&](const Quadruple* control) {
+        stats.parseMs += clock.lap();
+        std::vector<Quadruple> result = optimizeBlock(optimizer, block.data(), block.data() + block.size(), control,
+                                                      liveOut, nullptr, StatsHooks(stats, dump));
+        stats.quadsOut += result.size();
+        clock.lap();
+        out.write(result, symbols);
+        out.endSegment();
+        stats.writeMs += clock.lap();
+        block.clear();
+        symbols.clear();
+        symbols.reserveTemporaries(reserved);
+        if (mapped) mapped->release(scanner.remaining().data() - contents.data());
+    };
+    
+    Quadruple quad;
+    while (scanner.next(symbols, quad)) {
+        ++count;
         
-        if (varToNode.find(value) != varToNode.end())
-            return varToNode[value];
+        if (endsBlock(quad)) {
+            flush(&quad);
+        } else {
+            block.push_back(quad);
+            if (block.size() == blockSize) flush(nullptr);
+        }
+    }
+    flush(nullptr);
+    stats.optimizer += optimizer.stats();
+    
+    return count;
+}
+
+// One block of the text as streamBlocks would cut it. Each block is parsed into its own symbol
+// table and optimized by the worker's DAGOptimizer; only the names behind the symbol tables
+// are shared, through a lock-free table.
+struct TextBlock {
+    std::string_view text;
+    SymbolTable symbols;
+    std::vector<Quadruple> result;
+    size_t count = 0;
+    RunStats stats;
+    std::exception_ptr error;
+    
+    explicit TextBlock(SharedSymbolTable* names) : symbols(names) {}
+};
+
+// Cuts the next block off buffer: after a control quad or one without a result, or once it holds
+// blockSize others.
+std::string_view nextTextBlock(std::string_view& buffer, size_t blockSize) {
+    QuadScanner scanner(buffer);
+    size_t quads = 0;
+    std::string_view parts[4];
+    while (scanner.next(parts)) {
+        if (isControlOpcode(builtinOpcode(parts[0])) || parts[3].empty() || ++quads == blockSize) break;
+    }
+    std::string_view block = buffer.substr(0, scanner.remaining().data() - buffer.data());
+    buffer = scanner.remaining();
+    return block;
+}
+
+void optimizeTextBlock(TextBlock& block, const DriverOptions& options, const LiveOutSet* liveOut) {
+    try {
+        PhaseClock clock;
+        Workspace& workspace = threadWorkspace();
+        std::vector<Quadruple>& quads = workspace.quads;
+        quads.clear();
+        parseQuadruples(block.text, block.symbols, quads);
+        block.count = quads.size();
+        block.stats.parseMs += clock.lap();
         
-        int id = nodes.size();
-        nodes.emplace_back(id, value);
+        const Quadruple* end = quads.data() + quads.size();
+        const Quadruple* control = !quads.empty() && endsBlock(quads.back()) ? end - 1 : nullptr;
+        DAGOptimizer& optimizer = workspace.optimizer;
+        optimizer.reset(block.symbols);
+        configureOptimizer(optimizer, options);
+        optimizer.reserve(quads.size());
+        block.result = optimizeBlock(optimizer, quads.data(), control ? control : end, control, liveOut, nullptr,
+                                     StatsHooks(block.stats));
+        block.stats.quadsOut += block.result.size();
+        block.stats.optimizer += optimizer.stats();
+    }
+    catch (...) {
+        block.error = std::current_exception();
+    }
+}
+
+// streamBlocks with the blocks of a window optimized on a pool, one for the whole input, and
+// written back in input order; the output is identical to a serial run.
+size_t streamBlocksInParallel(std::string_view contents, MappedFile* mapped, size_t blockSize,
+                              const DriverOptions& options, const LiveOutSet* liveOut, size_t jobs, QuadWriter& out,
+                              RunStats& stats) {
+    const size_t windowSize = jobs * 4;
+    std::string_view buffer = contents;
+    SharedSymbolTable names(std::min<size_t>(contents.size() / 8, kMaxSharedSymbols));
+    const size_t reserved = highestTemporaryIn(contents, mapped);
+    std::vector<TextBlock> window;
+    window.reserve(windowSize);
+    WorkStealingPool pool(jobs);
+    size_t count = 0;
+    
+    while (!buffer.empty()) {
+        window.clear();
+        while (window.size() < windowSize && !buffer.empty()) {
+            window.emplace_back(&names);
+            window.back().symbols.reserveTemporaries(reserved);
+            window.back().text = nextTextBlock(buffer, blockSize);
+        }
         
-        if (!std::all_of(value.begin(), value.end(), 
-                [](char c) { return std::isdigit(c) || c == '-'; })) {
-            varToNode[value] = id;
-            nodes[id].aliases.push_back(value);
+        for (TextBlock& block : window) {
+            pool.submit([&block, &options, liveOut]() { optimizeTextBlock(block, options, liveOut); });
         }
+        pool.run();
         
-        return id;
+        PhaseClock clock;
+        for (TextBlock& block : window) {
+            if (block.error) std::rethrow_exception(block.error);
+            out.write(block.result, block.symbols);
+            out.endSegment();
+            count += block.count;
+            stats += block.stats;
+        }
+        stats.writeMs += clock.lap();
+        if (mapped) mapped->release(buffer.data() - contents.data());
     }
+    
+    return count;
+}
 
-    DAGNode& getNode(int id) {
-        if (id < 0 || id >= static_cast<int>(nodes.size())) {
-            throw std::out_of_range("Node index out of range: " + std::to_string(id));
+// Text or binary input (detected by its magic) in, optimized quadruples out. Binary input is
+// always loaded whole, and so is text with --global-cse or dead-code elimination, which needs
+// the liveness of the whole control-flow graph. Blocks are optimized one at a time while their
+// DAGs are dumped. Returns the number of input quadruples.
+size_t optimizeInput(std::string_view contents, MappedFile* mapped, const DriverOptions& options, QuadWriter& out,
+                     RunStats& stats, DagDump* dump) {
+    if (options.streaming && !options.acrossBlocks && !options.eliminateDeadCode && !isBinaryQuadFile(contents)) {
+        size_t blockSize = options.blockSize != 0 ? options.blockSize : kDefaultStreamBlockSize;
+        if (options.blockJobs > 1 && !dump) {
+            stats.quadsIn = streamBlocksInParallel(contents, mapped, blockSize, options, options.liveOutSet(),
+                                                   options.blockJobs, out, stats);
+        } else {
+            stats.quadsIn = streamBlocks(contents, mapped, blockSize, options, options.liveOutSet(), out, stats,
+                                         dump);
         }
-        return nodes[id];
+        return stats.quadsIn;
     }
     
-public:
-    void buildDAG(const std::vector<Quadruple>& quads) {
-        for (const auto& quad : quads) {
-            if (quad.op == "=") {
-                if (quad.arg1.empty()) {
-                    continue;
-                }
-                
-                int srcNodeId = getNodeForValue(quad.arg1);
-                varToNode[quad.result] = srcNodeId;
-                getNode(srcNodeId).aliases.push_back(quad.result);
-            } else {
-                std::string constResult;
-                if (evaluateConstant(quad.op, quad.arg1, quad.arg2, constResult)) {
-                    int constNodeId = getNodeForValue(constResult);
-                    varToNode[quad.result] = constNodeId;
-                    getNode(constNodeId).aliases.push_back(quad.result);
-                } else {
-                    int leftId = getNodeForValue(quad.arg1);
-                    int rightId = quad.arg2.empty() ? -1 : getNodeForValue(quad.arg2);
-                    
-                    int existingNodeId = findCommonExpr(quad.op, leftId, rightId);
-                    if (existingNodeId != -1) {
-
-                        varToNode[quad.result] = existingNodeId;
-                        getNode(existingNodeId).aliases.push_back(quad.result);
-                    } else {
-
-                        int newNodeId = nodes.size();
-                        nodes.emplace_back(newNodeId, quad.op, leftId, rightId);
-                        registerExpr(quad.op, leftId, rightId, newNodeId);
-                        varToNode[quad.result] = newNodeId;
-                        getNode(newNodeId).aliases.push_back(quad.result);
-                    }
-                }
-            }
-        }
+    PhaseClock clock;
+    Workspace& workspace = threadWorkspace();
+    SymbolTable& symbols = workspace.symbols;
+    std::vector<Quadruple>& inputQuads = workspace.quads;
+    symbols.clear();
+    inputQuads.clear();
+    if (isBinaryQuadFile(contents)) {
+        loadBinaryQuadruples(contents, symbols, inputQuads);
+    } else {
+        parseQuadruples(contents, symbols, inputQuads);
+    }
+    stats.parseMs += clock.lap();
+    stats.quadsIn = inputQuads.size();
+    if (options.coalesce) {
+        propagateCopies(inputQuads.data(), inputQuads.size(), symbols, options.liveOut, options.blockSize);
+        stats.buildMs += clock.lap();
+    }
+    
+    optimizeBlocks(inputQuads, symbols, options.blockSize, options.acrossBlocks, options, options.liveOutSet(), out,
+                   stats, dump);
+    clock.lap();
+    out.endSegment();
+    stats.writeMs += clock.lap();
+    return inputQuads.size();
+}
+
+// Where the output for inputFile goes, mirroring its path below the input directory. Creates
+// the directories on the way.
+std::string outputPathFor(const std::string& inputFile, const DriverOptions& options) {
+    namespace fs = std::filesystem;
+    fs::path relative = fs::path(inputFile).lexically_relative(options.inputDir);
+    if (relative.empty() || *relative.begin() == "..") {
+        relative = fs::path(inputFile).filename();
+    }
+    if (relative.has_parent_path()) {
+        ensureDirectoryExists((fs::path(options.outputDir) / relative.parent_path()).string());
+    }
+    return (fs::path(options.outputDir) / relative).string();
+}
+
+// The cache entry the output for contents is stored under, or "" when outputs are not cached.
+std::string cacheEntryFor(std::string_view contents, const DriverOptions& options) {
+    if (options.cacheDir.empty() || options.dumpDag) return std::string();
+    return cacheEntryPath(options, contents);
+}
+
+bool inCache(const std::string& cacheEntry) {
+    std::error_code ec;
+    return !cacheEntry.empty() && std::filesystem::exists(cacheEntry, ec);
+}
+
+// Links cacheEntry into place as outputFile if the entry exists. The old output may be a link
+// into the cache, so it is unlinked rather than overwritten.
+bool restoreFromCache(const std::string& cacheEntry, const std::string& outputFile) {
+    if (!inCache(cacheEntry)) return false;
+    std::remove(outputFile.c_str());
+    return linkOrCopy(cacheEntry, outputFile);
+}
+
+// Returns whether an output file was written; stats covers the file either way.
+bool processFile(const std::string& inputFile, const DriverOptions& options, std::ostream& log, std::ostream& errors,
+                 RunStats& stats) {
+    PhaseClock clock;
+    MappedFile input(inputFile);
+    stats.readMs += clock.lap();
+    
+    // On failure no output is left, so nothing stale from an earlier run stays behind.
+    std::string outputFile = outputPathFor(inputFile, options);
+    if (input.contents().empty()) {
+        std::remove(outputFile.c_str());
+        errors << "Warning: File is empty: " << inputFile << std::endl;
+        return false;
     }
     
-    std::vector<Quadruple> generateQuadruples() {
-        std::vector<Quadruple> result;
-        if (nodes.empty()) return result;
+    std::string cacheEntry = cacheEntryFor(input.contents(), options);
+    if (restoreFromCache(cacheEntry, outputFile)) {
+        stats.cacheHits = 1;
+        log << "Processed file: " << inputFile << " -> " << outputFile << " (cached)" << std::endl;
+        if (options.printStats) printStats(log, stats);
+        return true;
+    }
+    
+    // Written under a staging name and renamed into place once complete, see publishOutput.
+    std::string staging = stagingPathFor(outputFile);
+    try {
+        QuadWriter outFile(staging, options.outputFormat);
         
-        std::vector<bool> processed(nodes.size(), false);
-        std::set<int> required;
+        if (!outFile.isOpen()) {
+            errors << "Error: Could not open output file: " << outputFile << std::endl;
+            return false;
+        }
         
-        for (const auto& entry : varToNode) {
-            if (entry.second >= 0 && entry.second < static_cast<int>(nodes.size())) {
-                required.insert(entry.second);
+        std::string dumpFile = outputFile + dagDumpExtension(options.dagFormat);
+        std::optional<DagDump> dump;
+        if (options.dumpDag) {
+            dump.emplace(dumpFile, options);
+            if (!dump->out.isOpen()) {
+                outFile.close();
+                std::remove(staging.c_str());
+                std::remove(outputFile.c_str());
+                errors << "Error: Could not open DAG dump file: " << dumpFile << std::endl;
+                return false;
             }
         }
         
-        std::function<void(int)> processNode = [&](int nodeId) {
-            if (nodeId < 0 || nodeId >= static_cast<int>(nodes.size()) || processed[nodeId]) return;
-            
-            DAGNode& node = nodes[nodeId];
-            
-            if (node.left != -1) processNode(node.left);
-            if (node.right != -1) processNode(node.right);
+        if (optimizeInput(input.contents(), &input, options, outFile, stats, dump ? &*dump : nullptr) == 0) {
+            outFile.close();
+            std::remove(staging.c_str());
+            std::remove(outputFile.c_str());
+            errors << "Error: No valid quadruples found in file: " << inputFile << std::endl;
+            return false;
+        }
+        
+        clock.lap();
+        bool closed = outFile.close() && publishOutput(staging, outputFile);
+        stats.writeMs += clock.lap();
+        if (!closed) {
+            std::remove(staging.c_str());
+            std::remove(outputFile.c_str());
+            errors << "Error: Could not write output file: " << outputFile << std::endl;
+            return false;
+        }
+        if (dump && !dump->out.close()) {
+            errors << "Error: Could not write DAG dump file: " << dumpFile << std::endl;
+            return false;
+        }
+        if (!cacheEntry.empty()) storeInCache(outputFile, cacheEntry);
+        log << "Processed file: " << inputFile << " -> " << outputFile << std::endl;
+        if (options.printStats) printStats(log, stats);
+        return true;
+    }
+    catch (const std::exception& e) {
+        std::remove(staging.c_str());
+        std::remove(outputFile.c_str());
+        errors << "Error processing file " << inputFile << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Pipe mode: the whole of stdin is one input and the result goes to stdout.
+int processStandardStreams(const DriverOptions& options) {
+    RunStats stats;
+    PhaseClock clock;
+    std::string contents;
+    char chunk[1 << 16];
+    for (;;) {
+        ssize_t count = ::read(STDIN_FILENO, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) break;
+        contents.append(chunk, count);
+    }
+    stats.readMs += clock.lap();
+    
+    try {
+        QuadWriter out(STDOUT_FILENO, options.outputFormat);
+        std::optional<DagDump> dump;
+        if (options.dumpDag) dump.emplace(STDERR_FILENO, options);
+        if (optimizeInput(contents, nullptr, options, out, stats, dump ? &*dump : nullptr) == 0) {
+            std::cerr << "Error: No valid quadruples found on standard input." << std::endl;
+            return 1;
+        }
+        clock.lap();
+        bool closed = out.close();
+        stats.writeMs += clock.lap();
+        if (!closed) {
+            std::cerr << "Error: Could not write to standard output." << std::endl;
+            return 1;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error processing standard input: " << e.what() << std::endl;
+        return 1;
+    }
+    
+    if (options.printStats) printStats(std::cerr, stats);
+    if (!options.statsJson.empty() && !writeStatsJsonFile(options.statsJson, {{"-", stats}}, stats)) {
+        std::cerr << "Error: Could not write stats file: " << options.statsJson << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+uintmax_t fileSize(const std::string& filePath) {
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(filePath, ec);
+    return ec ? 0 : size;
+}
+
+// Indices into files, largest file first, so the longest jobs start early.
+std::vector<size_t> largestFirst(const std::vector<std::string>& files) {
+    std::vector<std::pair<uintmax_t, size_t>> bySize;
+    for (size_t i = 0; i < files.size(); ++i) {
+        bySize.emplace_back(fileSize(files[i]), i);
+    }
+    std::stable_sort(bySize.begin(), bySize.end(),
+            [](const auto& a, const auto& b) { return a.first > b.first; });
+    
+    std::vector<size_t> order;
+    for (const auto& entry : bySize) order.push_back(entry.second);
+    return order;
+}
+
+// Largest files go first so the long tail is made of small files. Each file's messages are
+// buffered and printed in one piece so lines from different workers never interleave.
+// processed[i] and stats[i] report on files[i].
+void processFilesInParallel(const std::vector<std::string>& files, const DriverOptions& options,
+                            std::vector<char>& processed, std::vector<RunStats>& stats) {
+    std::mutex consoleMutex;
+    WorkStealingPool pool(std::min(options.jobs, files.size()));
+    for (size_t index : largestFirst(files)) {
+        pool.submit([&, index]() {
+            std::ostringstream log;
+            std::ostringstream errors;
+            processed[index] = processFile(files[index], options, log, errors, stats[index]);
             
-            if (!node.isLeaf()) {
-                std::string leftVar;
-                if (node.left >= 0 && node.left < static_cast<int>(nodes.size()) && !nodes[node.left].aliases.empty()) {
-                    leftVar = nodes[node.left].aliases[0];
-                } else if (node.left >= 0 && node.left < static_cast<int>(nodes.size())) {
-                    leftVar = nodes[node.left].op;
-                }
-                
-                std::string rightVar;
-                if (node.right >= 0 && node.right < static_cast<int>(nodes.size()) && !nodes[node.right].aliases.empty()) {
-                    rightVar = nodes[node.right].aliases[0];
-                } else if (node.right >= 0 && node.right < static_cast<int>(nodes.size())) {
-                    rightVar = nodes[node.right].op;
-                }
-                
-                if (!node.aliases.empty()) {
-                    result.push_back({node.op, leftVar, rightVar, node.aliases[0]});
-                
-                    for (size_t i = 1; i < node.aliases.size(); ++i) {
-                        result.push_back({"=", node.aliases[0], "", node.aliases[i]});
-                    }
-                }
-            } else if (std::all_of(node.op.begin(), node.op.end(), 
-                   [](char c) { return std::isdigit(c) || c == '-'; })) {
-                for (const auto& alias : node.aliases) {
-                    result.push_back({"=", node.op, "", alias});
-                }
-            } else if (node.aliases.size() > 1) {
-                std::string primaryVar = node.aliases[0];
-                for (size_t i = 1; i < node.aliases.size(); ++i) {
-                    result.push_back({"=", primaryVar, "", node.aliases[i]});
-                }
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            std::cout << log.str() << std::flush;
+            std::cerr << errors.str() << std::flush;
+        });
+    }
+    pool.run();
+}
+
+// Bounded queue between pipeline stages: push waits while it is full and pop while it is empty,
+// until close(), after which pop drains what is left and then fails.
+template <typename T>
+class BoundedQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    
+public:
+    explicit BoundedQueue(size_t limit) : capacity(std::max<size_t>(limit, 1)) {}
+    
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&]() { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+    
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+// One file on its way through the pipeline: read, then optimized into output, then written.
+struct FileJob {
+    size_t index = 0;
+    std::unique_ptr<MappedFile> input;
+    std::string outputFile;
+    std::string cacheEntry;
+    std::string output;
+    bool cached = false;
+    bool optimized = false;
+    std::ostringstream log;
+    std::ostringstream errors;
+    RunStats stats;
+};
+
+// processFile but for the writes and cache restores, which are left to the writer stage.
+void optimizeFileJob(FileJob& job, const std::string& inputFile, const DriverOptions& options) {
+    std::string_view contents = job.input->contents();
+    job.outputFile = outputPathFor(inputFile, options);
+    if (contents.empty()) {
+        job.errors << "Warning: File is empty: " << inputFile << std::endl;
+        return;
+    }
+    
+    // A hit is only noted here; the writer links the entry into place, as it does every other
+    // change to the outputs.
+    job.cacheEntry = cacheEntryFor(contents, options);
+    if (inCache(job.cacheEntry)) {
+        job.stats.cacheHits = 1;
+        job.cached = true;
+        return;
+    }
+    
+    try {
+        std::string dumpFile = job.outputFile + dagDumpExtension(options.dagFormat);
+        std::optional<DagDump> dump;
+        if (options.dumpDag) {
+            dump.emplace(dumpFile, options);
+            if (!dump->out.isOpen()) {
+                job.errors << "Error: Could not open DAG dump file: " << dumpFile << std::endl;
+                return;
             }
-            
-            processed[nodeId] = true;
-        };
-        
-        for (int nodeId : required) {
-            processNode(nodeId);
         }
         
-        return result;
+        QuadWriter out(&job.output, options.outputFormat);
+        if (optimizeInput(contents, job.input.get(), options, out, job.stats, dump ? &*dump : nullptr) == 0) {
+            job.errors << "Error: No valid quadruples found in file: " << inputFile << std::endl;
+            return;
+        }
+        out.close();
+        if (dump && !dump->out.close()) {
+            job.errors << "Error: Could not write DAG dump file: " << dumpFile << std::endl;
+            return;
+        }
+        job.optimized = true;
+    }
+    catch (const std::exception& e) {
+        job.errors << "Error processing file " << inputFile << ": " << e.what() << std::endl;
     }
+}
 
-    void printDAG() {
-        std::cout << "DAG Structure:" << std::endl;
-        for (const auto& node : nodes) {
-            std::cout << "Node " << node.id << ": op=" << node.op;
-            
-            if (node.left != -1) 
-                std::cout << ", left=" << node.left;
-            if (node.right != -1) 
-                std::cout << ", right=" << node.right;
-            
-            std::cout << ", aliases=[";
-            for (size_t i = 0; i < node.aliases.size(); ++i) {
-                if (i > 0) std::cout << ", ";
-                std::cout << node.aliases[i];
+bool writeFileJob(FileJob& job, const std::string& inputFile, const DriverOptions& options) {
+    if (job.cached) {
+        if (!restoreFromCache(job.cacheEntry, job.outputFile)) {
+            std::remove(job.outputFile.c_str());
+            job.errors << "Error: Could not restore cached output: " << job.outputFile << std::endl;
+            return false;
+        }
+        job.log << "Processed file: " << inputFile << " -> " << job.outputFile << " (cached)" << std::endl;
+        if (options.printStats) printStats(job.log, job.stats);
+        return true;
+    }
+    if (!job.optimized) {
+        // As in processFile, a file that failed leaves no output from an earlier run behind.
+        std::remove(job.outputFile.c_str());
+        return false;
+    }
+    
+    PhaseClock clock;
+    std::string staging = stagingPathFor(job.outputFile);
+    BufferedWriter outFile(staging);
+    if (!outFile.isOpen()) {
+        job.errors << "Error: Could not open output file: " << job.outputFile << std::endl;
+        return false;
+    }
+    outFile.append(job.output);
+    bool closed = outFile.close() && publishOutput(staging, job.outputFile);
+    job.stats.writeMs += clock.lap();
+    std::string().swap(job.output);
+    if (!closed) {
+        std::remove(staging.c_str());
+        std::remove(job.outputFile.c_str());
+        job.errors << "Error: Could not write output file: " << job.outputFile << std::endl;
+        return false;
+    }
+    if (!job.cacheEntry.empty()) storeInCache(job.outputFile, job.cacheEntry);
+    job.log << "Processed file: " << inputFile << " -> " << job.outputFile << std::endl;
+    if (options.printStats) printStats(job.log, job.stats);
+    return true;
+}
+
+// Reads, optimizes and writes on separate threads so none waits for another's I/O: a reader
+// maps and faults in files ahead of options.jobs optimizer workers, and one writer writes their
+// outputs, which are held in memory meanwhile. Each queue holds up to two files per worker.
+void processFilesInPipeline(const std::vector<std::string>& files, const DriverOptions& options,
+                            std::vector<char>& processed, std::vector<RunStats>& stats) {
+    const size_t workers = std::min(options.jobs, files.size());
+    BoundedQueue<std::unique_ptr<FileJob>> loaded(workers * 2);
+    BoundedQueue<std::unique_ptr<FileJob>> finished(workers * 2);
+    
+    std::thread reader([&]() {
+        for (size_t index : largestFirst(files)) {
+            auto job = std::make_unique<FileJob>();
+            job->index = index;
+            PhaseClock clock;
+            job->input = std::make_unique<MappedFile>(files[index]);
+            job->input->prefetch();
+            job->stats.readMs += clock.lap();
+            loaded.push(std::move(job));
+        }
+        loaded.close();
+    });
+    
+    std::thread writer([&]() {
+        std::unique_ptr<FileJob> job;
+        while (finished.pop(job)) {
+            processed[job->index] = writeFileJob(*job, files[job->index], options);
+            stats[job->index] = job->stats;
+            std::cout << job->log.str() << std::flush;
+            std::cerr << job->errors.str() << std::flush;
+        }
+    });
+    
+    std::vector<std::thread> optimizers;
+    for (size_t i = 0; i < workers; ++i) {
+        optimizers.emplace_back([&]() {
+            std::unique_ptr<FileJob> job;
+            while (loaded.pop(job)) {
+                optimizeFileJob(*job, files[job->index], options);
+                job->input.reset();
+                finished.push(std::move(job));
             }
-            std::cout << "]" << std::endl;
+        });
+    }
+    
+    for (auto& thread : optimizers) thread.join();
+    finished.close();
+    reader.join();
+    writer.join();
+}
+
+// Writes a synthetic straight-line block of `quads` quadruples. cseRatio is the chance that an
+// expression repeats an earlier one, constDensity the chance that an operand is a literal and
+// aliasFanout the expected number of copies made of each result.
+std::string generateSyntheticQuads(size_t quads, const BenchmarkOptions& bench) {
+    static const char* const ops[] = {"+", "-", "*", "/", "%", "&", "|", "^"};
+    std::mt19937_64 rng(bench.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    
+    struct Expr { const char* op; std::string left; std::string right; };
+    std::vector<Expr> history;
+    std::vector<std::string> values;
+    for (int i = 0; i < 16; ++i) values.push_back("V" + std::to_string(i));
+    
+    auto pickOperand = [&]() {
+        if (chance(rng) < bench.constDensity) return std::to_string(rng() % 100);
+        size_t window = std::min<size_t>(values.size(), 64);
+        return values[values.size() - 1 - rng() % window];
+    };
+    
+    std::string text;
+    text.reserve(quads * 20);
+    size_t temp = 0;
+    size_t emitted = 0;
+    while (emitted < quads) {
+        Expr expr;
+        if (!history.empty() && chance(rng) < bench.cseRatio) {
+            expr = history[history.size() - 1 - rng() % std::min<size_t>(history.size(), 256)];
+        } else {
+            expr = {ops[rng() % (sizeof(ops) / sizeof(ops[0]))], pickOperand(), pickOperand()};
+            history.push_back(expr);
         }
         
-        std::cout << "Variable to Node mappings:" << std::endl;
-        for (const auto& entry : varToNode) {
-            std::cout << entry.first << " -> Node " << entry.second << std::endl;
+        std::string result = "T" + std::to_string(++temp);
+        text += "("; text += expr.op; text += ", "; text += expr.left; text += ", ";
+        text += expr.right; text += ", "; text += result; text += ")\n";
+        values.push_back(result);
+        ++emitted;
+        
+        double copies = bench.aliasFanout;
+        while (emitted < quads && (copies >= 1.0 || (copies > 0.0 && chance(rng) < copies))) {
+            std::string alias = "V" + std::to_string(rng() % 16);
+            text += "(=, "; text += result; text += ", , "; text += alias; text += ")\n";
+            values.push_back(alias);
+            ++emitted;
+            copies -= 1.0;
         }
     }
-};
+    return text;
+}
 
-std::vector<Quadruple> parseQuadruples(const std::vector<std::string>& lines) {
-    std::vector<Quadruple> quads;
+long peakResidentKilobytes() {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+int runBenchmark(const DriverOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    auto millis = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::string scratch = (std::filesystem::temp_directory_path() / "dagopt_bench.txt").string();
     
-    for (const auto& line : lines) {
-        if (line.empty()) continue;
+    std::cout << std::setw(10) << "quads" << std::setw(11) << "parse ms" << std::setw(11) << "build ms"
+              << std::setw(11) << "emit ms" << std::setw(11) << "write ms" << std::setw(14) << "quads/s"
+              << std::setw(10) << "out" << std::setw(12) << "peak KB" << std::endl;
+    
+    for (size_t size : options.bench.sizes) {
+        std::string text = generateSyntheticQuads(size, options.bench);
         
-        size_t start = line.find('(');
-        size_t end = line.find(')');
-        if (start == std::string::npos || end == std::string::npos) continue;
+        auto start = Clock::now();
+        SymbolTable symbols;
+        std::vector<Quadruple> quads;
+        parseQuadruples(text, symbols, quads);
+        auto parsed = Clock::now();
         
-        std::string quadData = line.substr(start + 1, end - start - 1);
+        DAGOptimizer optimizer(symbols);
+        configureOptimizer(optimizer, options);
+        optimizer.buildDAG(quads);
+        auto built = Clock::now();
         
-        std::vector<std::string> parts;
-        std::istringstream ss(quadData);
-        std::string part;
+        std::vector<Quadruple> optimized = optimizer.generateQuadruples(options.liveOutSet());
+        auto generated = Clock::now();
         
-        while (std::getline(ss, part, ',')) {
-            part.erase(0, part.find_first_not_of(" \t\r\n"));
-            part.erase(part.find_last_not_of(" \t\r\n") + 1);
-            parts.push_back(part);
+        {
+            QuadWriter out(scratch);
+            out.write(optimized, symbols);
         }
+        auto written = Clock::now();
         
-        while (parts.size() < 4) parts.push_back("");
-        
-        quads.push_back({parts[0], parts[1], parts[2], parts[3]});
+        double seconds = std::chrono::duration<double>(written - start).count();
+        std::cout << std::fixed << std::setprecision(2)
+                  << std::setw(10) << quads.size() << std::setw(11) << millis(parsed - start)
+                  << std::setw(11) << millis(built - parsed) << std::setw(11) << millis(generated - built)
+                  << std::setw(11) << millis(written - generated)
+                  << std::setw(14) << std::setprecision(0) << (seconds > 0 ? quads.size() / seconds : 0.0)
+                  << std::setw(10) << optimized.size() << std::setw(12) << peakResidentKilobytes() << std::endl;
     }
     
-    return quads;
+    std::remove(scratch.c_str());
+    return 0;
 }
 
-void printQuadruples(const std::vector<Quadruple>& quads) {
-    for (const auto& quad : quads) {
-        std::cout << "(" << quad.op << ", " << quad.arg1 << ", " 
-                  << quad.arg2 << ", " << quad.result << ")" << std::endl;
+// Quadruples of text or binary contents.
+void loadQuadruples(std::string_view contents, SymbolTable& symbols, std::vector<Quadruple>& quads) {
+    if (isBinaryQuadFile(contents)) {
+        loadBinaryQuadruples(contents, symbols, quads);
+    } else {
+        parseQuadruples(contents, symbols, quads);
     }
 }
 
-std::vector<std::string> readFile(const std::string& filePath) {
-    std::vector<std::string> lines;
-    std::ifstream file(filePath);
+// A quadruple without a result as it ran: its opcode and the values of its operands.
+struct RunEvent {
+    Opcode op;
+    int64_t arg1;
+    int64_t arg2;
     
-    if (file.is_open()) {
-        std::string line;
-        while (std::getline(file, line)) {
-            lines.push_back(line);
-        }
-        file.close();
+    bool operator!=(const RunEvent& other) const {
+        return op != other.op || arg1 != other.arg1 || arg2 != other.arg2;
+    }
+};
+
+// Runs quads on values, indexed by symbol, with the arithmetic of a wrapping target. Operations
+// that do not fold (division by zero, custom opcodes, ...) yield a value derived from their
+// opcode and operands, so equal operations agree. Quadruples without a result (param, print,
+// call, ...) are appended to events in the order they run. Constants keep the values they enter
+// with even if a quadruple assigns to one, as the optimizer reads them. Returns false if it did
+// not stop within maxSteps quadruples.
+bool runQuadruples(const std::vector<Quadruple>& quads, const SymbolTable& symbols, FoldTarget target,
+                   std::vector<int64_t>& values, std::vector<RunEvent>& events, size_t maxSteps) {
+    std::unordered_map<SymbolId, size_t> labels;
+    for (size_t i = 0; i < quads.size(); ++i) {
+        if (quads[i].op == Opcode::Label) labels.emplace(quads[i].result, i);
     }
+    const std::vector<int64_t> entry = values;
+    auto value = [&](SymbolId id) {
+        return id == kNoSymbol ? 0 : symbols.isConstant(id) ? entry[id] : values[id];
+    };
     
-    return lines;
+    size_t pc = 0;
+    for (size_t steps = 0; pc < quads.size(); ++steps) {
+        if (steps == maxSteps) return false;
+        const Quadruple& quad = quads[pc++];
+        int64_t a = value(quad.arg1);
+        int64_t b = value(quad.arg2);
+        if (quad.op == Opcode::Label) continue;
+        if (isControlOpcode(quad.op)) {
+            bool taken = quad.op == Opcode::Jump || (quad.op == Opcode::JumpNz && a != 0) ||
+                         (quad.op == Opcode::JumpLt && a < b) || (quad.op == Opcode::JumpLe && a <= b) ||
+                         (quad.op == Opcode::JumpGt && a > b) || (quad.op == Opcode::JumpGe && a >= b) ||
+                         (quad.op == Opcode::JumpEq && a == b) || (quad.op == Opcode::JumpNe && a != b);
+            if (taken) {
+                auto label = labels.find(quad.result);
+                pc = label != labels.end() ? label->second : quads.size();
+            }
+            continue;
+        }
+        if (quad.result == kNoSymbol) {
+            events.push_back({quad.op, a, b});
+            continue;
+        }
+        
+        int64_t result = a;
+        FoldFunction apply = foldFunction(quad.op);
+        if (quad.op != Opcode::Assign && !(apply && apply(a, b, result, target))) {
+            uint64_t operands[2] = {static_cast<uint64_t>(a), static_cast<uint64_t>(b)};
+            std::string_view bytes(reinterpret_cast<const char*>(operands), sizeof(operands));
+            result = target.wrap(hashContents(bytes, hashContents(symbols.opcodeName(quad.op))));
+        }
+        values[quad.result] = result;
+    }
+    return true;
 }
 
-std::vector<std::string> listFilesInDirectory(const std::string& directoryPath) {
-    std::vector<std::string> files;
-    std::string command = "ls " + directoryPath + " 2>/dev/null";
-    FILE* pipe = popen(command.c_str(), "r");
-    
-    if (pipe) {
-        char buffer[128];
-        while (!feof(pipe)) {
-            if (fgets(buffer, 128, pipe) != nullptr) {
-                std::string file = buffer;
-                if (!file.empty() && file[file.size() - 1] == '\n') {
-                    file.erase(file.size() - 1);
-                }
-                files.push_back(directoryPath + "/" + file);
+// Whether output leaves the variables input assigns (those in liveOut, if given) with the same
+// values as input does and runs the same quadruples without a result on the same values, for a
+// few seeded assignments of the variables they read. Literals keep their values; other constants
+// get a value derived from their name, like the variables.
+bool sameBehaviour(const std::vector<Quadruple>& input, const std::vector<Quadruple>& reference,
+                   const std::vector<Quadruple>& output, const SymbolTable& symbols, const DriverOptions& options,
+                   std::string& mismatch) {
+    const size_t kSeeds = 4;
+    const size_t maxSteps = std::max<size_t>(1000000, input.size() * 100);
+    FoldTarget target{options.fold.bits, true};
+    
+    std::vector<SymbolId> observed;
+    std::vector<char> seen(symbols.size(), 0);
+    for (const Quadruple& quad : input) {
+        if (isControlOpcode(quad.op) || quad.result == kNoSymbol || seen[quad.result]) continue;
+        seen[quad.result] = 1;
+        const LiveOutSet* liveOut = options.liveOutSet();
+        if (!liveOut || liveOut->contains(symbols.name(quad.result))) observed.push_back(quad.result);
+    }
+    
+    for (uint64_t seed = 0; seed < kSeeds; ++seed) {
+        std::vector<int64_t> initial(symbols.size());
+        for (size_t id = 0; id < symbols.size(); ++id) {
+            uint64_t hash = hashContents(symbols.name(id), seed);
+            if (symbols.hasImmediate(id)) initial[id] = target.wrap(symbols.immediate(id));
+            else initial[id] = seed % 2 == 0 ? static_cast<int64_t>(hash % 11) - 5 : target.wrap(hash);
+        }
+        
+        std::vector<int64_t> expected = initial;
+        std::vector<RunEvent> expectedEvents;
+        if (!runQuadruples(reference, symbols, target, expected, expectedEvents, maxSteps)) continue;
+        std::vector<int64_t> actual = initial;
+        std::vector<RunEvent> actualEvents;
+        if (!runQuadruples(output, symbols, target, actual, actualEvents, maxSteps)) {
+            mismatch = "output does not stop";
+            return false;
+        }
+        auto describe = [&](const RunEvent& event) {
+            return "(" + symbols.opcodeName(event.op) + ", " + std::to_string(event.arg1) + ", "
+                 + std::to_string(event.arg2) + ")";
+        };
+        for (size_t i = 0; i < std::max(expectedEvents.size(), actualEvents.size()); ++i) {
+            if (i == actualEvents.size()) {
+                mismatch = "missing " + describe(expectedEvents[i]);
+                return false;
+            }
+            if (i == expectedEvents.size() || actualEvents[i] != expectedEvents[i]) {
+                mismatch = "runs " + describe(actualEvents[i])
+                         + (i == expectedEvents.size() ? "" : ", expected " + describe(expectedEvents[i]));
+                return false;
+            }
+        }
+        for (SymbolId id : observed) {
+            if (expected[id] != actual[id]) {
+                mismatch = symbols.name(id) + " is " + std::to_string(actual[id]) + ", expected " +
+                           std::to_string(expected[id]);
+                return false;
             }
         }
-        pclose(pipe);
     }
-    
-    return files;
+    return true;
 }
 
-void ensureDirectoryExists(const std::string& dir) {
-    std::string command = "mkdir -p " + dir + " 2>/dev/null";
-    system(command.c_str());
+// A golden file whose first line starts with this holds an earlier output of the optimizer
+// rather than a hand-checked answer.
+const std::string_view kSnapshotMarker = "# snapshot";
+
+bool isSnapshot(std::string_view golden) {
+    return golden.substr(0, kSnapshotMarker.size()) == kSnapshotMarker;
 }
 
-void processFile(const std::string& inputFile, const std::string& outputDir) {
-    std::string filename = inputFile;
-    size_t lastSlash = filename.find_last_of('/');
-    if (lastSlash != std::string::npos) {
-        filename = filename.substr(lastSlash + 1);
+// Where text first differs from expected, by line.
+std::string firstDifference(std::string_view text, std::string_view expected) {
+    auto show = [](std::string_view line, bool atEnd) { return atEnd ? "the end" : "\"" + std::string(line) + "\""; };
+    for (size_t line = 1;; ++line) {
+        size_t end = std::min(text.find('\n'), text.size());
+        size_t expectedEnd = std::min(expected.find('\n'), expected.size());
+        if (text.empty() && expected.empty()) return "line " + std::to_string(line - 1) + " ends differently";
+        if (text.empty() || expected.empty() || text.substr(0, end) != expected.substr(0, expectedEnd)) {
+            return "line " + std::to_string(line) + " is " + show(text.substr(0, end), text.empty()) + ", expected "
+                 + show(expected.substr(0, expectedEnd), expected.empty());
+        }
+        text.remove_prefix(std::min(end + 1, text.size()));
+        expected.remove_prefix(std::min(expectedEnd + 1, expected.size()));
     }
-    
-    std::vector<std::string> inputLines = readFile(inputFile);
-    
-    if (inputLines.empty()) {
-        std::cerr << "Warning: File is empty: " << inputFile << std::endl;
-        return;
+}
+
+// The golden output for inputFile: its name with the leading letters replaced by "ans", so
+// test1.txt is checked against ans1.txt, in the relative directory below goldenDir.
+std::string goldenPathFor(const std::string& inputFile, const DriverOptions& options) {
+    namespace fs = std::filesystem;
+    fs::path relative = fs::path(inputFile).lexically_relative(options.inputDir);
+    if (relative.empty() || *relative.begin() == "..") {
+        relative = fs::path(inputFile).filename();
+    }
+    std::string name = relative.filename().string();
+    size_t letters = 0;
+    while (letters < name.size() && std::isalpha(static_cast<unsigned char>(name[letters]))) ++letters;
+    return (fs::path(options.checks.goldenDir) / relative.parent_path() / ("ans" + name.substr(letters))).string();
+}
+
+// micros is 0 for a file too fast to time, whose size alone is compared.
+struct BaselineEntry {
+    double micros = 0;
+    size_t quadsOut = 0;
+};
+
+// One "<microseconds> <output quads> <file>" line per input, with "-" for an untimed file.
+std::unordered_map<std::string, BaselineEntry> readBaseline(const std::string& path) {
+    std::unordered_map<std::string, BaselineEntry> baseline;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        BaselineEntry entry;
+        std::string micros;
+        std::string file;
+        if (line.empty() || line[0] == '#' || !(fields >> micros >> entry.quadsOut)) continue;
+        if (micros != "-") entry.micros = std::strtod(micros.c_str(), nullptr);
+        std::getline(fields >> std::ws, file);
+        baseline[file] = entry;
     }
+    return baseline;
+}
+
+bool parseCount(const char* text, size_t& count) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0') return false;
+    count = value;
+    return true;
+}
+
+bool parseRatio(const char* text, double& ratio) {
+    char* end = nullptr;
+    double value = std::strtod(text, &end);
+    if (end == text || *end != '\0' || value < 0) return false;
+    ratio = value;
+    return true;
+}
+
+std::vector<std::string> splitList(std::string_view list) {
+    std::vector<std::string> items;
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = trimField(list.substr(0, comma));
+        if (!item.empty()) items.emplace_back(item);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+    }
+    return items;
+}
+
+bool parseArguments(int argc, char* argv[], DriverOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stream") {
+            options.streaming = true;
+        } else if (arg == "--pipeline") {
+            options.pipeline = true;
+        } else if (arg == "--global-cse") {
+            options.acrossBlocks = true;
+        } else if (arg == "--coalesce") {
+            options.coalesce = true;
+            options.eliminateDeadCode = true;
+        } else if (arg == "--fold-width" && i + 1 < argc) {
+            size_t bits = 0;
+            if (!parseCount(argv[++i], bits) || (bits != 8 && bits != 16 && bits != 32 && bits != 64)) return false;
+            options.fold.bits = bits;
+        } else if (arg == "--fold-wrap") {
+            options.fold.wraps = true;
+        } else if (arg == "--compact") {
+            options.compact = true;
+        } else if (arg == "--dump-dag" && i + 1 < argc) {
+            std::string format = argv[++i];
+            options.dumpDag = true;
+            if (format == "text") options.dagFormat = DagFormat::Text;
+            else if (format == "dot") options.dagFormat = DagFormat::Dot;
+            else if (format == "json") options.dagFormat = DagFormat::Json;
+            else return false;
+        } else if (arg == "--dag-root" && i + 1 < argc) {
+            for (auto& name : splitList(argv[++i])) {
+                options.dagFilter.roots.push_back(std::move(name));
+            }
+        } else if (arg == "--dag-nodes" && i + 1 < argc) {
+            std::string range = argv[++i];
+            size_t dash = range.find('-');
+            if (dash == std::string::npos || !parseCount(range.substr(0, dash).c_str(), options.dagFilter.firstNode)) {
+                return false;
+            }
+            if (dash + 1 < range.size() && !parseCount(range.c_str() + dash + 1, options.dagFilter.lastNode)) {
+                return false;
+            }
+        } else if (arg == "--input" && i + 1 < argc) {
+            options.inputDir = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.outputDir = argv[++i];
+        } else if (arg == "-r" || arg == "--recursive") {
+            options.recursive = true;
+        } else if (arg == "--glob" && i + 1 < argc) {
+            options.globs.push_back(argv[++i]);
+        } else if (arg == "--live-out" && i + 1 < argc) {
+            options.eliminateDeadCode = true;
+            for (auto& name : splitList(argv[++i])) {
+                options.liveOut.variables.insert(std::move(name));
+            }
+        } else if (arg == "--temp-pattern" && i + 1 < argc) {
+            options.eliminateDeadCode = true;
+            options.liveOut.tempPattern = argv[++i];
+        } else if (arg == "--output-format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "text") options.outputFormat = QuadFormat::Text;
+            else if (format == "binary") options.outputFormat = QuadFormat::Binary;
+            else return false;
+        } else if (arg == "--stats") {
+            options.printStats = true;
+        } else if (arg == "--stats-json" && i + 1 < argc) {
+            options.statsJson = argv[++i];
+        } else if (arg == "--cache" && i + 1 < argc) {
+            options.cacheDir = argv[++i];
+        } else if (arg == "--check" && i + 1 < argc) {
+            options.check = true;
+            options.checks.goldenDir = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            options.checks.baseline = argv[++i];
+        } else if (arg == "--update-baseline") {
+            options.checks.updateBaseline = true;
+        } else if (arg == "--max-slowdown" && i + 1 < argc) {
+            if (!parseRatio(argv[++i], options.checks.maxSlowdown)) return false;
+        } else if (arg == "--bench") {
+            options.benchmark = true;
+        } else if (arg == "--bench-sizes" && i + 1 < argc) {
+            options.bench.sizes.clear();
+            for (const auto& item : splitList(argv[++i])) {
+                size_t size = 0;
+                if (!parseCount(item.c_str(), size)) return false;
+                options.bench.sizes.push_back(size);
+            }
+        } else if (arg == "--cse-ratio" && i + 1 < argc) {
+            if (!parseRatio(argv[++i], options.bench.cseRatio)) return false;
+        } else if (arg == "--const-density" && i + 1 < argc) {
+            if (!parseRatio(argv[++i], options.bench.constDensity)) return false;
+        } else if (arg == "--alias-fanout" && i + 1 < argc) {
+            if (!parseRatio(argv[++i], options.bench.aliasFanout)) return false;
+        } else if (arg == "--seed" && i + 1 < argc) {
+            size_t seed = 0;
+            if (!parseCount(argv[++i], seed)) return false;
+            options.bench.seed = seed;
+        } else if (arg == "--block-size" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.blockSize)) return false;
+        } else if (arg == "-j" && i + 1 < argc) {
+            if (!parseCount(argv[++i], options.jobs)) return false;
+            if (options.jobs == 0) options.jobs = std::max(1u, std::thread::hardware_concurrency());
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Adds the options of a "# check: ARGS" first line of contents, which the parser skips like any
+// line that is not a quadruple. False if ARGS do not parse.
+bool parseCheckHeader(std::string_view contents, DriverOptions& options) {
+    const std::string_view kPrefix = "# check:";
+    if (contents.substr(0, kPrefix.size()) != kPrefix) return true;
+    std::string_view line = contents.substr(kPrefix.size(), contents.find('\n') - kPrefix.size());
+    std::istringstream words{std::string(line)};
+    std::vector<std::string> args = {"dagopt"};
+    for (std::string word; words >> word;) args.push_back(word);
+    std::vector<char*> argv;
+    for (std::string& arg : args) argv.push_back(arg.data());
+    return parseArguments(static_cast<int>(argv.size()), argv.data(), options);
+}
+
+// Optimizes every input in memory with the given options and checks the result. It must match a
+// snapshot golden byte for byte, or behave like a hand-checked one when run on seeded values
+// (see sameBehaviour), and it must always behave like the input. An input whose first line is
+// "# check: ARGS" is optimized with ARGS added to the options. Each file's output size, and its
+// best time over repeated runs when it is long enough to time, are compared with a stored
+// baseline, or recorded as the baseline if there is none yet. Fails on any mismatch, on output
+// that grew and on files slower than the baseline by more than maxSlowdown.
+int runChecks(const std::vector<std::string>& files, const DriverOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    const double kMinTimingMs = 50;
+    // Best times under a millisecond vary with the machine and its load more than any slowdown
+    // worth catching, so such files are recorded untimed and only their sizes compared.
+    const double kMinTimedMicros = 1000;
+    const CheckOptions& checks = options.checks;
+    bool haveBaseline = !checks.baseline.empty() && !checks.updateBaseline && fileSize(checks.baseline) > 0;
+    std::unordered_map<std::string, BaselineEntry> baseline;
+    if (haveBaseline) baseline = readBaseline(checks.baseline);
+    std::ostringstream recorded;
+    recorded << "# microseconds, output quads, file" << std::endl;
+    size_t failures = 0;
     
-    try {
-        std::vector<Quadruple> inputQuads = parseQuadruples(inputLines);
-        
-        if (inputQuads.empty()) {
-            std::cerr << "Error: No valid quadruples found in file: " << inputFile << std::endl;
-            return;
+    std::cout << std::left << std::setw(32) << "file" << std::right << std::setw(9) << "in"
+              << std::setw(9) << "out" << std::setw(8) << "ratio" << std::setw(11) << "time us"
+              << std::setw(11) << "base us" << "  result" << std::endl;
+    
+    for (const std::string& file : files) {
+        std::vector<std::string> problems;
+        MappedFile input(file);
+        DriverOptions fileOptions = options;
+        if (!parseCheckHeader(input.contents(), fileOptions)) problems.push_back("bad # check: line");
+        std::string output;
+        size_t runs = 0;
+        double best = 0;
+        try {
+            double totalMs = 0;
+            do {
+                output.clear();
+                RunStats stats;
+                QuadWriter out(&output, fileOptions.outputFormat);
+                auto start = Clock::now();
+                optimizeInput(input.contents(), nullptr, fileOptions, out, stats, nullptr);
+                out.close();
+                double micros = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+                best = runs++ == 0 ? micros : std::min(best, micros);
+                totalMs += micros / 1000;
+            } while (problems.empty() && totalMs < kMinTimingMs);
+        }
+        catch (const std::exception& e) {
+            problems.push_back(e.what());
         }
         
-        DAGOptimizer optimizer;
-        optimizer.buildDAG(inputQuads);
-        
-        std::vector<Quadruple> optimizedQuads = optimizer.generateQuadruples();
-        
-        std::string outputFile = outputDir + "/" + filename;
-        std::ofstream outFile(outputFile);
+        SymbolTable symbols;
+        std::vector<Quadruple> inputQuads;
+        std::vector<Quadruple> outputQuads;
+        loadQuadruples(input.contents(), symbols, inputQuads);
+        loadQuadruples(output, symbols, outputQuads);
+        std::string goldenFile = goldenPathFor(file, options);
+        bool haveGolden = fileSize(goldenFile) > 0;
         
-        if (!outFile.is_open()) {
-            std::cerr << "Error: Could not open output file: " << outputFile << std::endl;
-            return;
+        // A snapshot golden must match the output byte for byte, which catches any drift; a
+        // hand-checked one must behave like it. Either way the output must behave like the input.
+        std::string mismatch;
+        if (problems.empty() && inputQuads.empty()) {
+            problems.push_back("no valid quadruples");
+        } else if (problems.empty()) {
+            if (haveGolden) {
+                MappedFile golden(goldenFile);
+                std::string_view expected = golden.contents();
+                if (isSnapshot(expected)) {
+                    expected.remove_prefix(std::min(expected.find('\n') + 1, expected.size()));
+                    if (output != expected) {
+                        problems.push_back("differs from " + goldenFile + ": " + firstDifference(output, expected));
+                    }
+                } else {
+                    std::vector<Quadruple> goldenQuads;
+                    loadQuadruples(expected, symbols, goldenQuads);
+                    if (!sameBehaviour(inputQuads, goldenQuads, outputQuads, symbols, fileOptions, mismatch)) {
+                        problems.push_back("behaves differently from " + goldenFile + ": " + mismatch);
+                    }
+                }
+            }
+            if (!sameBehaviour(inputQuads, inputQuads, outputQuads, symbols, fileOptions, mismatch)) {
+                problems.push_back("behaves differently from input: " + mismatch);
+            }
         }
-
-        // outFile << "Original Quadruples:" << std::endl;
-        // for (const auto& quad : inputQuads) {
-        //     outFile << "(" << quad.op << ", " << quad.arg1 << ", " 
-        //             << quad.arg2 << ", " << quad.result << ")" << std::endl;
-        // }
         
-        // /outFile << std::endl << "Optimized Quadruples:" << std::endl;
-        for (const auto& quad : optimizedQuads) {
-            outFile << "(" << quad.op << ", " << quad.arg1 << ", " 
-                    << quad.arg2 << ", " << quad.result << ")" << std::endl;
+        auto entry = baseline.find(file);
+        bool compared = haveBaseline && entry != baseline.end();
+        if (compared && outputQuads.size() > entry->second.quadsOut) {
+            problems.push_back("output grew from " + std::to_string(entry->second.quadsOut) + " quadruples");
+        }
+        if (compared && entry->second.micros > 0 && best > entry->second.micros * (1 + checks.maxSlowdown)) {
+            problems.push_back("slower than baseline");
         }
+        if (best >= kMinTimedMicros) recorded << std::fixed << std::setprecision(1) << best;
+        else recorded << "-";
+        recorded << " " << outputQuads.size() << " " << file << std::endl;
         
-        outFile.close();
-        std::cout << "Processed file: " << inputFile << " -> " << outputFile << std::endl;
+        double ratio = inputQuads.empty() ? 0 : 1 - static_cast<double>(outputQuads.size()) / inputQuads.size();
+        std::cout << std::left << std::setw(32) << file << std::right << std::setw(9) << inputQuads.size()
+                  << std::setw(9) << outputQuads.size() << std::fixed << std::setprecision(1)
+                  << std::setw(7) << ratio * 100 << "%" << std::setw(11) << best << std::setw(11);
+        if (compared && entry->second.micros > 0) std::cout << entry->second.micros;
+        else std::cout << "-";
+        std::cout << "  " << (problems.empty() ? (haveGolden ? "ok" : "ok (no golden)") : "FAIL") << std::endl;
+        for (const std::string& problem : problems) std::cout << "    " << problem << std::endl;
+        if (!problems.empty()) ++failures;
     }
-    catch (const std::exception& e) {
-        std::cerr << "Error processing file " << inputFile << ": " << e.what() << std::endl;
+    
+    if (!checks.baseline.empty() && !haveBaseline) {
+        std::ofstream out(checks.baseline);
+        out << recorded.str();
+        if (!out.flush()) {
+            std::cerr << "Error: Could not write baseline file: " << checks.baseline << std::endl;
+            return 1;
+        }
+        std::cout << "Baseline written to: " << checks.baseline << std::endl;
     }
+    std::cout << (failures == 0 ? "All " + std::to_string(files.size()) + " files passed."
+                                : std::to_string(failures) + " of " + std::to_string(files.size()) + " files failed.")
+              << std::endl;
+    return failures == 0 ? 0 : 1;
 }
 
-int main() {
-    const std::string testDir = "test";
-    const std::string outputDir = "test_out";
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]" << std::endl
+              << "  --input DIR       read input files from DIR (default test); - reads stdin, writes stdout" << std::endl
+              << "  --output DIR      write results to DIR (default test_out)" << std::endl
+              << "  -r, --recursive   descend into subdirectories, mirroring them in the output" << std::endl
+              << "  --glob PATTERN    only process file names matching PATTERN (repeatable)" << std::endl
+              << "  --stream          optimize and write one block at a time" << std::endl
+              << "  --global-cse      reuse expressions computed in dominating blocks (loads files whole)" << std::endl
+              << "  --coalesce        propagate copies across blocks and drop the ones left dead (loads files whole)"
+              << std::endl
+              << "  --fold-width N    fold constants as N-bit integers: 8, 16, 32 (default) or 64" << std::endl
+              << "  --fold-wrap       let folds wrap around on overflow instead of leaving them unfolded" << std::endl
+              << "  --compact         pack alias lists to cut the memory used per DAG node" << std::endl
+              << "  --output-format F write text (default) or binary quadruples" << std::endl
+              << "  --dump-dag F      export each block's DAG as text, dot or json next to its output" << std::endl
+              << "                    (to stderr with --input -); blocks are then optimized serially" << std::endl
+              << "  --dag-root A,B    only dump nodes reachable from these variables (repeatable)" << std::endl
+              << "  --dag-nodes M-N   only dump nodes M to N of each block (N may be left out)" << std::endl
+              << "  --block-size N    also cut basic blocks every N quadruples"
+              << " (streaming default " << kDefaultStreamBlockSize << ")" << std::endl
+              << "  -j N              process N files in parallel (0 = one per core); with --stream," << std::endl
+              << "                    spare workers optimize the blocks of a file in parallel" << std::endl
+              << "  --pipeline        read and write files on their own threads while -j N workers" << std::endl
+              << "                    optimize, keeping each output in memory until it is written" << std::endl
+              << "  --live-out A,B    only keep these variables live at the end of the program, and what later" << std::endl
+              << "                    blocks read (repeatable); loads files whole" << std::endl
+              << "  --temp-pattern P  treat variables matching P as dead temporaries (default T[0-9]*)" << std::endl
+              << "  --stats           print phase times and optimizer counters per file and in total" << std::endl
+              << "  --stats-json FILE write the same numbers to FILE as JSON" << std::endl
+              << "  --cache DIR       reuse outputs cached in DIR for inputs seen before with the same options" << std::endl
+              << "  --check DIR       match each output to its golden ansN.txt in DIR and run it against its input," << std::endl
+              << "                    time it and exit with 1 on a mismatch or regression; writes nothing" << std::endl
+              << "  --baseline FILE   compare times and output sizes with FILE, or record them there" << std::endl
+              << "  --update-baseline record the current times and sizes in the --baseline file" << std::endl
+              << "  --max-slowdown R  slowdown over the baseline that fails a file (default 0.25)" << std::endl
+              << "  --bench           time each phase on synthetic blocks instead of reading files" << std::endl
+              << "  --bench-sizes L   comma-separated block lengths (default 1000,10000,100000,1000000)" << std::endl
+              << "  --cse-ratio R     chance an expression repeats an earlier one (default 0.2)" << std::endl
+              << "  --const-density R chance an operand is a literal (default 0.1)" << std::endl
+              << "  --alias-fanout R  expected copies made of each result (default 0.5)" << std::endl
+              << "  --seed N          generator seed (default 1)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    DriverOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
     
-    ensureDirectoryExists(outputDir);
+    if (options.benchmark) {
+        return runBenchmark(options);
+    }
+    
+    if (options.inputDir == "-") {
+        options.blockJobs = options.jobs;
+        return processStandardStreams(options);
+    }
+    
+    const std::string& testDir = options.inputDir;
+    const std::string& outputDir = options.outputDir;
     
-    std::vector<std::string> testFiles = listFilesInDirectory(testDir);
+    std::vector<std::string> testFiles = listFilesInDirectory(testDir, options.recursive, options.globs);
     
     if (testFiles.empty()) {
         std::cerr << "Error: No files found in the test directory." << std::endl;
         return 1;
     }
     
+    if (options.check) {
+        return runChecks(testFiles, options);
+    }
+    
+    ensureDirectoryExists(outputDir);
+    if (!options.cacheDir.empty()) ensureDirectoryExists(options.cacheDir);
+    
+    // Workers left over once every file has one go to the blocks inside each file.
+    if (testFiles.size() < options.jobs) {
+        options.blockJobs = options.jobs / testFiles.size();
+    }
+    
     std::cout << "Processing files from directory: " << testDir << std::endl;
-    for (const auto& file : testFiles) {
-        processFile(file, outputDir);
+    std::vector<char> processed(testFiles.size(), 0);
+    std::vector<RunStats> stats(testFiles.size());
+    if (options.pipeline) {
+        processFilesInPipeline(testFiles, options, processed, stats);
+    } else if (options.jobs > 1) {
+        processFilesInParallel(testFiles, options, processed, stats);
+    } else {
+        for (size_t i = 0; i < testFiles.size(); ++i) {
+            processed[i] = processFile(testFiles[i], options, std::cout, std::cerr, stats[i]);
+        }
     }
     
     std::cout << "All files processed. Results written to: " << outputDir << std::endl;
     
+    RunStats total;
+    std::vector<std::pair<std::string, RunStats>> perFile;
+    for (size_t i = 0; i < testFiles.size(); ++i) {
+        if (!processed[i]) continue;
+        total += stats[i];
+        perFile.emplace_back(testFiles[i], stats[i]);
+    }
+    if (options.printStats) {
+        std::cout << "Total (" << perFile.size() << " files):" << std::endl;
+        printStats(std::cout, total);
+    }
+    if (!options.statsJson.empty() && !writeStatsJsonFile(options.statsJson, perFile, total)) {
+        std::cerr << "Error: Could not write stats file: " << options.statsJson << std::endl;
+        return 1;
+    }
+    
     return 0;
 }